@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_sort.h"
+#include "psh.hpp"
+
+namespace psh
+{
+	// steps a cellular automaton on a bounded grid, keeping only the live cells in a perfect hash
+	// generation N is read from one map while generation N + 1 is collected and then built
+	// into another, so every cell sees the same generation no matter the order of the updates
+	// the two maps trade places every step and are rebuilt in place, with one workspace
+	// only live cells and their neighbours are visited, and the maps are built without
+	// positional hashes, since only contains is used, so the work per step grows with
+	// the live population instead of the size of the grid
+	// d is the dimensionality, PosInt and HashInt are passed on to the maps
+	template<uint d, class PosInt, class HashInt>
+	class automaton
+	{
+		using IndexInt = size_t;
+
+	public:
+		using map = psh::map<d, bool, PosInt, HashInt>;
+		using cell = point<d, PosInt>;
+		// whether a cell is alive in the next generation, given whether it's alive now
+		// and how many of its 3^d - 1 neighbours are
+		using rule_function = std::function<bool(bool alive, uint neighbours)>;
+
+	private:
+		point<d, PosInt> u_bar;
+		IndexInt u;
+		rule_function rule;
+		// the current generation, nullptr until something has been alive
+		std::unique_ptr<map> current;
+		// the next generation is built into this after current has been read,
+		// it's the previous generation's map, so its memory is reused
+		std::unique_ptr<map> next;
+		// nothing is alive, current is only kept for its memory
+		bool extinct;
+		IndexInt generation;
+		// neighbourhood of a cell, as offsets in [-1, 1] in every dimension
+		std::vector<point<d, int>> neighbourhood;
+		// reused between steps, so a running automaton doesn't allocate much
+		typename map::workspace w;
+		std::vector<IndexInt> candidates;
+		std::vector<uint8_t> alive_next;
+		std::vector<cell> live;
+
+	public:
+		// u_bar is the size of the grid, live is the first generation
+		automaton(const point<d, PosInt>& u_bar, const std::vector<cell>& live, rule_function rule)
+			: u_bar(u_bar), u(volume(u_bar)), rule(rule), extinct(true), generation(0),
+			  w(true, false, false)
+		{
+			IndexInt neighbourhood_size = 1;
+			for (uint j = 0; j < d; j++)
+			{
+				neighbourhood_size *= 3;
+			}
+			for (IndexInt i = 0; i < neighbourhood_size; i++)
+			{
+				point<d, int> offset;
+				IndexInt rest = i;
+				for (uint j = 0; j < d; j++)
+				{
+					offset[j] = int(rest % 3) - 1;
+					rest /= 3;
+				}
+				if (offset != point<d, int>())
+					neighbourhood.push_back(offset);
+			}
+			this->live = live;
+			build();
+		}
+
+		// Conway's game of life
+		static bool life(bool alive, uint neighbours)
+		{
+			return neighbours == 3 || (alive && neighbours == 2);
+		}
+
+		void step()
+		{
+			if (extinct)
+			{
+				generation++;
+				return;
+			}
+
+			// every live cell and all of its neighbours might be alive in the next generation
+			// cells outside the grid are marked with u, so they end up last after sorting
+			const IndexInt k = neighbourhood.size() + 1;
+			candidates.resize(current->size() * k);
+			live.clear();
+			for (auto e : *current)
+			{
+				live.push_back(e.location);
+			}
+			tbb::parallel_for(IndexInt(0), live.size(), [&](IndexInt i)
+				{
+					auto& p = live[i];
+					candidates[i * k] = point_to_index(p, u_bar, u);
+					for (IndexInt j = 0; j < neighbourhood.size(); j++)
+					{
+						cell q;
+						candidates[i * k + j + 1] = neighbour(p, neighbourhood[j], q)
+							? point_to_index(q, u_bar, u) : u;
+					}
+				});
+			tbb::parallel_sort(candidates.begin(), candidates.end());
+			candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+			if (!candidates.empty() && candidates.back() == u)
+				candidates.pop_back();
+
+			// count the neighbours of every candidate in parallel
+			// the current generation is only read, so the lookups don't need any locking
+			alive_next.resize(candidates.size());
+			tbb::parallel_for(IndexInt(0), candidates.size(), [&](IndexInt i)
+				{
+					auto p = index_to_point<d>(candidates[i], u_bar, u);
+					uint neighbours = 0;
+					for (auto& offset : neighbourhood)
+					{
+						cell q;
+						if (neighbour(p, offset, q) && current->contains(q))
+							neighbours++;
+					}
+					alive_next[i] = rule(current->contains(p), neighbours);
+				});
+
+			live.clear();
+			for (IndexInt i = 0; i < candidates.size(); i++)
+			{
+				if (alive_next[i])
+					live.push_back(index_to_point<d>(candidates[i], u_bar, u));
+			}
+			build();
+			generation++;
+		}
+
+		bool alive(const cell& p) const
+		{
+			return !extinct && current->contains(p);
+		}
+
+		// number of live cells
+		IndexInt population() const
+		{
+			return extinct ? 0 : current->size();
+		}
+
+		IndexInt generations() const
+		{
+			return generation;
+		}
+
+		// calls f(cell) for every live cell
+		template<class F>
+		void for_each_alive(F f) const
+		{
+			if (extinct)
+				return;
+			for (auto e : *current)
+			{
+				f(e.location);
+			}
+		}
+
+		size_t memory_size() const
+		{
+			return sizeof(*this) + (current ? current->memory_size() : 0)
+				+ (next ? next->memory_size() : 0) + w.memory_size()
+				+ sizeof(IndexInt) * candidates.capacity() + alive_next.capacity()
+				+ sizeof(cell) * live.capacity() + sizeof(point<d, int>) * neighbourhood.capacity();
+		}
+
+	private:
+		// p + offset, or false if that's outside the grid
+		bool neighbour(const cell& p, const point<d, int>& offset, cell& output) const
+		{
+			for (uint i = 0; i < d; i++)
+			{
+				int coordinate = int(p[i]) + offset[i];
+				if (coordinate < 0 || coordinate >= int(u_bar[i]))
+					return false;
+				output[i] = PosInt(coordinate);
+			}
+			return true;
+		}
+
+		// builds the next generation from live, and makes it the current one
+		void build()
+		{
+			extinct = live.empty();
+			if (extinct)
+				return;
+			auto data = [&](IndexInt i)
+				{
+					return typename map::data_t{live[i], true};
+				};
+			if (next)
+				next->assign(data, live.size(), w);
+			else
+				next.reset(new map(data, live.size(), u_bar, w));
+			std::swap(current, next);
+		}
+	};
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace psh
+{
+	// number of bits needed to store every value up to and including max
+	constexpr uint bits_needed(uint64_t max)
+	{
+		uint output = 0;
+		while (max != 0)
+		{
+			max >>= 1;
+			output++;
+		}
+		return output;
+	}
+
+	// a fixed number of fields, all with the same width of at most 64 bits,
+	// stored back to back without any padding
+	class bit_array
+	{
+		std::vector<uint64_t> words;
+		// width of each field in bits
+		uint width;
+		uint64_t mask;
+
+	public:
+		bit_array() : width(0), mask(0) { }
+		bit_array(size_t size, uint width)
+			: words((size * width + 63) / 64, 0), width(width),
+			  mask(width >= 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1) { }
+
+		uint64_t get(size_t i) const
+		{
+			if (width == 0)
+				return 0;
+			size_t bit = i * width;
+			size_t word = bit / 64;
+			uint shift = bit % 64;
+			uint64_t output = words[word] >> shift;
+			// the field might continue in the next word
+			if (shift + width > 64)
+				output |= words[word + 1] << (64 - shift);
+			return output & mask;
+		}
+
+		void set(size_t i, uint64_t value)
+		{
+			if (width == 0)
+				return;
+			value &= mask;
+			size_t bit = i * width;
+			size_t word = bit / 64;
+			uint shift = bit % 64;
+			words[word] = (words[word] & ~(mask << shift)) | (value << shift);
+			if (shift + width > 64)
+			{
+				uint spill = 64 - shift;
+				words[word + 1] = (words[word + 1] & ~(mask >> spill)) | (value >> spill);
+			}
+		}
+
+		uint field_width() const
+		{
+			return width;
+		}
+
+		size_t memory_size() const
+		{
+			return sizeof(*this) + sizeof(uint64_t) * words.capacity();
+		}
+	};
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "tbb/parallel_for_each.h"
+#include "psh.hpp"
+
+namespace psh
+{
+	// an unbounded perfect spatial hash, made up of independently built psh::map blocks
+	// a top-level hash maps chunk coordinates to blocks, each covering chunk_width^d points
+	// d is the dimensionality, T is the data type
+	// PosInt is the integer type used for positions inside a chunk
+	// HashInt is the integer type used for the position hash
+	// GlobalInt is the (signed) integer type used for positions in the world
+	template<uint d, class T, class PosInt, class HashInt, class GlobalInt = int>
+	class chunked_map
+	{
+	public:
+		using block = map<d, T, PosInt, HashInt>;
+		using local_point = point<d, PosInt>;
+		using global_point = point<d, GlobalInt>;
+
+		struct data_t
+		{
+			global_point location;
+			T contents;
+		};
+
+	private:
+		using IndexInt = size_t;
+		using block_data = typename block::data_t;
+
+		// remembers the last chunk that was looked up
+		struct cache
+		{
+			global_point chunk;
+			block* b = nullptr;
+			IndexInt generation = 0;
+			bool valid = false;
+		};
+
+		// width of each chunk, in every dimension
+		PosInt chunk_width;
+		// top-level hash from chunk coordinates to blocks
+		std::unordered_map<global_point, std::unique_ptr<block>> chunks;
+		// bumped whenever a block is built, rebuilt or evicted, invalidates all caches
+		IndexInt generation;
+		cache last;
+
+	public:
+		// keeps its own chunk cache, so that several threads can look up concurrently
+		// as long as nobody builds, rebuilds or evicts at the same time
+		class cursor
+		{
+			chunked_map& owner;
+			cache c;
+
+		public:
+			cursor(chunked_map& owner) : owner(owner) { }
+
+			T& get(const global_point& p)
+			{
+				return owner.get(p, c);
+			}
+		};
+
+		chunked_map(PosInt chunk_width) : chunk_width(chunk_width), generation(0) { }
+
+		// consecutive lookups in the same chunk skip the top-level probe
+		T& get(const global_point& p)
+		{
+			return get(p, last);
+		}
+
+		// tries to store an element in place, without rebuilding anything
+		bool add(const global_point& p, const T& contents)
+		{
+			auto b = find(chunk_of(p), last);
+			return b != nullptr && b->add(local_of(p), contents);
+		}
+
+		// stores data, building or rebuilding every chunk it touches in parallel
+		// locations already stored are updated in place when possible
+		void insert(const std::vector<data_t>& data)
+		{
+			// group the new data by chunk
+			std::unordered_map<global_point, std::vector<block_data>> grouped;
+			for (auto& element : data)
+			{
+				grouped[chunk_of(element.location)].push_back(
+					block_data{local_of(element.location), element.contents});
+			}
+
+			// all blocks have to exist in the top-level hash before going parallel
+			std::vector<std::pair<std::unique_ptr<block>*, const std::vector<block_data>*>> work;
+			work.reserve(grouped.size());
+			for (auto& kvp : grouped)
+			{
+				work.emplace_back(&chunks[kvp.first], &kvp.second);
+			}
+
+			tbb::parallel_for_each(work.begin(), work.end(),
+				[&](const typename decltype(work)::value_type& w)
+				{
+					build(*w.first, *w.second);
+				});
+			invalidate();
+		}
+
+		// rebuilds a single chunk from its own contents, e.g. after many adds
+		void rebuild(const global_point& chunk)
+		{
+			auto it = chunks.find(chunk);
+			if (it == chunks.end())
+				return;
+			it->second.reset(new block(it->second->rebuild(
+				[](IndexInt) { return block_data(); }, 0)));
+			invalidate();
+		}
+
+		// removes a single chunk and everything stored in it
+		void evict(const global_point& chunk)
+		{
+			chunks.erase(chunk);
+			invalidate();
+		}
+
+		// removes every chunk for which pred(chunk) is true
+		template<class Predicate>
+		void evict_if(Predicate pred)
+		{
+			for (auto it = chunks.begin(); it != chunks.end();)
+			{
+				if (pred(it->first))
+					it = chunks.erase(it);
+				else
+					++it;
+			}
+			invalidate();
+		}
+
+		bool contains_chunk(const global_point& chunk) const
+		{
+			return chunks.count(chunk) != 0;
+		}
+
+		IndexInt num_chunks() const
+		{
+			return chunks.size();
+		}
+
+		// the chunk a position in the world belongs to, rounding towards negative infinity
+		global_point chunk_of(const global_point& p) const
+		{
+			global_point output;
+			const GlobalInt width = GlobalInt(chunk_width);
+			for (uint i = 0; i < d; i++)
+			{
+				output[i] = p[i] >= 0 ? p[i] / width : -((-(p[i] + 1)) / width) - 1;
+			}
+			return output;
+		}
+
+		// the position inside its chunk of a position in the world
+		local_point local_of(const global_point& p) const
+		{
+			auto chunk = chunk_of(p);
+			local_point output;
+			for (uint i = 0; i < d; i++)
+			{
+				output[i] = PosInt(p[i] - chunk[i] * GlobalInt(chunk_width));
+			}
+			return output;
+		}
+
+		size_t memory_size() const
+		{
+			size_t output = sizeof(*this)
+				+ sizeof(void*) * chunks.bucket_count()
+				+ (sizeof(typename decltype(chunks)::value_type) + sizeof(void*)) * chunks.size();
+			for (auto& kvp : chunks)
+			{
+				output += kvp.second->memory_size();
+			}
+			return output;
+		}
+
+	private:
+		block* find(const global_point& chunk, cache& c)
+		{
+			if (c.valid && c.generation == generation && c.chunk == chunk)
+				return c.b;
+
+			auto it = chunks.find(chunk);
+			c.chunk = chunk;
+			c.b = it == chunks.end() ? nullptr : it->second.get();
+			c.generation = generation;
+			c.valid = true;
+			return c.b;
+		}
+
+		T& get(const global_point& p, cache& c)
+		{
+			auto b = find(chunk_of(p), c);
+			if (b == nullptr)
+				throw std::out_of_range("Element not found in map");
+			return b->get(local_of(p));
+		}
+
+		// builds a new block, or updates an existing one and rebuilds it if needed
+		void build(std::unique_ptr<block>& b, const std::vector<block_data>& data)
+		{
+			if (!b)
+			{
+				b.reset(new block([&](IndexInt i) { return data[i]; }, data.size(), chunk_width));
+				return;
+			}
+
+			// a single batch, so the positional hashes are fixed with one sweep over the chunk
+			// instead of one for every element that's added
+			typename block::workspace w(false);
+			b->apply_updates([&](IndexInt i) { return data[i]; }, data.size(), w);
+		}
+
+		void invalidate()
+		{
+			generation++;
+			last.valid = false;
+		}
+	};
+}
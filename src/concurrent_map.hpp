@@ -0,0 +1,210 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "psh.hpp"
+
+namespace psh
+{
+	// a finished map that can be read and written by several threads at once
+	// every slot of the hash table is guarded by its own seqlock:
+	// - readers never block and never write to shared memory, they just retry
+	//   if a writer changed the slot while they were reading it
+	// - writers lock only the slot they write to, so writers to different slots never wait
+	//   for each other, and a reader only waits for a writer to the slot it's reading
+	// guarantees:
+	// - get and find never see a partially written element, they see the contents
+	//   as they were either before or after every write to that slot
+	// - set, add and get/find of the same location are linearizable
+	// - size is exact once all writers are done
+	// writes can only update elements that are stored or claim empty slots,
+	// anything that needs a rebuild has to wait for release()
+	// slots are matched by their stored location, not by the positional hash, since the
+	// hashes of the slots that add claims are only fixed by release()
+	// T must be trivially copyable, since readers copy it while it might be written
+	template<uint d, class T, class PosInt, class HashInt, class Allocator = std::allocator<T>,
+		class Hash = prime_hash<d, PosInt, HashInt>>
+	class concurrent_map
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+		using IndexInt = size_t;
+		using source = map<d, T, PosInt, HashInt, Allocator, Hash>;
+		using entry = typename source::entry;
+
+		// the state of a slot is a version counter, bumped by every write,
+		// with the lowest two bits used as flags
+		static constexpr uint32_t locked = 1;
+		static constexpr uint32_t occupied = 2;
+		static constexpr uint32_t version_step = 4;
+
+		source s;
+		std::unique_ptr<std::atomic<uint32_t>[]> states;
+		std::atomic<IndexInt> n;
+
+	public:
+		using data_t = typename source::data_t;
+
+		// takes over a finished map, it can't be used directly until it's released again
+		explicit concurrent_map(source&& s)
+			: s(std::move(s)), states(new std::atomic<uint32_t>[this->s.m]), n(this->s.n)
+		{
+			if (!this->s.positional_hashes)
+				throw std::invalid_argument("The map was built without positional hashes");
+			this->s.require_enumerable();
+			for (IndexInt i = 0; i < this->s.m; i++)
+			{
+				states[i].store(this->s.occupied(i) ? occupied : 0, std::memory_order_relaxed);
+			}
+		}
+
+		// copies the contents stored at p into output, or returns false if p isn't stored
+		// lock-free, safe to call at any time
+		bool find(const point<d, PosInt>& p, T& output) const
+		{
+			auto i = point_to_index(s.h(p), s.m_bar, s.m);
+			entry e;
+			point<d, PosInt> location;
+			if (!(read(i, e, location) & occupied) || location != p)
+				return false;
+			output = e.contents;
+			return true;
+		}
+
+		// same as above, but throws if p isn't stored
+		T get(const point<d, PosInt>& p) const
+		{
+			T output;
+			if (!find(p, output))
+				throw std::out_of_range("Element not found in map");
+			return output;
+		}
+
+		// updates an element that is already stored, returns false if p isn't stored
+		bool set(const point<d, PosInt>& p, const T& contents)
+		{
+			auto i = point_to_index(s.h(p), s.m_bar, s.m);
+			auto state = lock(i);
+			bool stored = (state & occupied) && s.locations[i] == p;
+			if (stored)
+				s.H[i].contents = contents;
+			unlock(i, stored ? state + version_step : state);
+			return stored;
+		}
+
+		// updates an element, or stores it if its slot is empty
+		// returns false if the slot is taken by another element
+		bool add(const point<d, PosInt>& p, const T& contents)
+		{
+			auto i = point_to_index(s.h(p), s.m_bar, s.m);
+			auto state = lock(i);
+			if (!(state & occupied))
+			{
+				s.H[i] = entry(data_t{p, contents}, s.hash);
+				s.locations[i] = p;
+				s.fingerprints[i] = s.fingerprint(p);
+				n.fetch_add(1, std::memory_order_relaxed);
+				unlock(i, (state | occupied) + version_step);
+				return true;
+			}
+			else if (s.locations[i] == p)
+			{
+				s.H[i].contents = contents;
+				unlock(i, state + version_step);
+				return true;
+			}
+			unlock(i, state);
+			return false;
+		}
+
+		// number of stored elements
+		IndexInt size() const
+		{
+			return n.load(std::memory_order_relaxed);
+		}
+
+		// gives the map back, e.g. to rebuild it or iterate over it
+		// the positional hashes of the slots that add claimed are fixed first, with one
+		// sweep over the domain, or the map is rebuilt if a slot has no k left that works
+		// no other thread may use this concurrent_map during or after the call
+		source release()
+		{
+			typename source::workspace w(false);
+			for (IndexInt i = 0; i < s.m; i++)
+			{
+				if ((states[i].load(std::memory_order_relaxed) & occupied) && !s.occupied(i))
+				{
+					s.set_occupied(i);
+					w.added.push_back(i);
+				}
+			}
+			s.n = n.load(std::memory_order_relaxed);
+			if (!w.added.empty() && !s.rehash_slots(w))
+			{
+				s.rebuild([](IndexInt)
+					{
+						return data_t();
+					}, 0, w);
+			}
+			// elements added here never made it into the map's prefilter
+			s.build_prefilter();
+			states.reset();
+			return std::move(s);
+		}
+
+		size_t memory_size() const
+		{
+			return sizeof(*this) - sizeof(s) + s.memory_size() + sizeof(uint32_t) * s.m;
+		}
+
+	private:
+		// copies slot i and its location, retrying until no writer changed them
+		// while they were being copied, returns the state they were copied in
+		uint32_t read(IndexInt i, entry& output, point<d, PosInt>& location) const
+		{
+			while (true)
+			{
+				auto before = states[i].load(std::memory_order_acquire);
+				if (before & locked)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				output = s.H[i];
+				location = s.locations[i];
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (states[i].load(std::memory_order_relaxed) == before)
+					return before;
+			}
+		}
+
+		// spins until slot i is locked by this thread, returns its state from before
+		uint32_t lock(IndexInt i)
+		{
+			auto state = states[i].load(std::memory_order_relaxed);
+			while (true)
+			{
+				if (state & locked)
+				{
+					std::this_thread::yield();
+					state = states[i].load(std::memory_order_relaxed);
+				}
+				else if (states[i].compare_exchange_weak(state, state | locked,
+					std::memory_order_acquire, std::memory_order_relaxed))
+				{
+					// the lock has to be visible before any of the writes that follow
+					std::atomic_thread_fence(std::memory_order_release);
+					return state;
+				}
+			}
+		}
+
+		void unlock(IndexInt i, uint32_t state)
+		{
+			states[i].store(state & ~locked, std::memory_order_release);
+		}
+	};
+}
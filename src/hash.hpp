@@ -0,0 +1,268 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "point.hpp"
+#include "util.hpp"
+
+namespace psh
+{
+	// a 64 bit integer as a C++ literal
+	inline std::string source_literal(uint64_t value)
+	{
+		std::ostringstream stream;
+		stream << "0x" << std::hex << value << "ull";
+		return stream.str();
+	}
+
+	// hash policies for map, each one provides:
+	// - h0(p), where p goes in the hash table before its bucket's offset is added
+	// - h1(p), the bucket of p, i.e. where its offset is in the offset table
+	// - hk(p, k), the positional hash stored next to the contents, where k >= 1 is a parameter
+	//   of the slot that's increased until no other point in the domain shares its value
+	// h0 and h1 are points, which point_to_index reduces to a table index
+	// pick(generator) draws new random parameters, before every build
+	// h0_limit(u_bar) is an upper bound of each coordinate of h0 over the domain
+	// write_source(stream) writes the arguments of a constexpr constructor that
+	// recreates the policy with the same parameters, see static_map::write_source
+
+	// the hash functions from the paper: multiplication by primes from a fixed list
+	template<uint d, class PosInt, class HashInt>
+	class prime_hash
+	{
+		using IndexInt = size_t;
+
+		IndexInt M0;
+		IndexInt M1;
+		IndexInt M2;
+
+	public:
+		prime_hash() : M0(1), M1(1), M2(1) { }
+		constexpr prime_hash(IndexInt M0, IndexInt M1, IndexInt M2) : M0(M0), M1(M1), M2(M2) { }
+
+		template<class Generator>
+		void pick(Generator& generator)
+		{
+			// M0 must be different from M1
+			M0 = prime(generator);
+			while ((M1 = prime(generator)) == M0);
+			M2 = prime(generator);
+		}
+
+		point<d, IndexInt> h0(const point<d, PosInt>& p) const
+		{
+			return p * M0;
+		}
+		point<d, IndexInt> h1(const point<d, PosInt>& p) const
+		{
+			return p * M1;
+		}
+		HashInt hk(const point<d, PosInt>& p, HashInt k) const
+		{
+			// p dot {k, k * k, k * k * k...} * M2
+			// creds to David
+			return p * point<d, PosInt>::increasing_pow(k) * M2;
+		}
+
+		point<d, IndexInt> h0_limit(const point<d, PosInt>& u_bar) const
+		{
+			return u_bar * M0;
+		}
+
+		void write_source(std::ostream& stream) const
+		{
+			stream << M0 << "u, " << M1 << "u, " << M2 << "u";
+		}
+
+		friend std::ostream& operator<<(std::ostream& stream, const prime_hash& hash)
+		{
+			return stream << "(" << hash.M0 << ", " << hash.M1 << ", " << hash.M2 << ")";
+		}
+
+	private:
+		// returns a random prime from a small predefined list
+		template<class Generator>
+		static IndexInt prime(Generator& generator)
+		{
+			static const std::vector<IndexInt> primes{ 53, 97, 193, 389, 769, 1543, 3079,
+				6151, 12289, 24593, 49157, 98317, 196613, 393241, 786433, 1572869,
+				3145739, 6291469 };
+			// a local, since maps are built on several threads at once
+			std::uniform_int_distribution<IndexInt> prime_dist(0, primes.size() - 1);
+
+			return primes[prime_dist(generator)];
+		}
+	};
+
+	// multiply-shift hashing: every coordinate is multiplied by a random 64 bit number,
+	// plus another one, and the high bits of the result are used
+	// the positional hash does the same to a random linear combination of the coordinates,
+	// with a multiplier that depends on k
+	template<uint d, class PosInt, class HashInt>
+	class multiply_shift_hash
+	{
+		using IndexInt = size_t;
+		// bits of h0 and h1 per coordinate
+		static constexpr uint bits = 32;
+
+		point<d, uint64_t> a0;
+		point<d, uint64_t> b0;
+		point<d, uint64_t> a1;
+		point<d, uint64_t> b1;
+		point<d, uint64_t> c2;
+		uint64_t a2;
+		uint64_t b2;
+
+	public:
+		multiply_shift_hash() : a2(1), b2(0) { }
+		constexpr multiply_shift_hash(const point<d, uint64_t>& a0, const point<d, uint64_t>& b0,
+			const point<d, uint64_t>& a1, const point<d, uint64_t>& b1, const point<d, uint64_t>& c2,
+			uint64_t a2, uint64_t b2)
+			: a0(a0), b0(b0), a1(a1), b1(b1), c2(c2), a2(a2), b2(b2) { }
+
+		template<class Generator>
+		void pick(Generator& generator)
+		{
+			std::uniform_int_distribution<uint64_t> dist;
+			for (uint i = 0; i < d; i++)
+			{
+				a0[i] = dist(generator) | 1;
+				b0[i] = dist(generator);
+				a1[i] = dist(generator) | 1;
+				b1[i] = dist(generator);
+				c2[i] = dist(generator) | 1;
+			}
+			a2 = dist(generator) | 1;
+			b2 = dist(generator);
+		}
+
+		point<d, IndexInt> h0(const point<d, PosInt>& p) const
+		{
+			return shift(p, a0, b0);
+		}
+		point<d, IndexInt> h1(const point<d, PosInt>& p) const
+		{
+			return shift(p, a1, b1);
+		}
+		HashInt hk(const point<d, PosInt>& p, HashInt k) const
+		{
+			uint64_t x = 0;
+			for (uint i = 0; i < d; i++)
+			{
+				x += c2[i] * p[i];
+			}
+			// the multiplier is odd for every k
+			return HashInt((x * (a2 + 2 * b2 * k)) >> (64 - sizeof(HashInt) * 8));
+		}
+
+		point<d, IndexInt> h0_limit(const point<d, PosInt>&) const
+		{
+			return point<d, IndexInt>::repeating(IndexInt(1) << bits);
+		}
+
+		void write_source(std::ostream& stream) const
+		{
+			for (auto& p : {a0, b0, a1, b1, c2})
+			{
+				stream << "{{";
+				for (uint i = 0; i < d; i++)
+				{
+					stream << (i == 0 ? "" : ", ") << source_literal(p[i]);
+				}
+				stream << "}}, ";
+			}
+			stream << source_literal(a2) << ", " << source_literal(b2);
+		}
+
+		friend std::ostream& operator<<(std::ostream& stream, const multiply_shift_hash& hash)
+		{
+			return stream << "(" << hash.a0 << ", " << hash.a1 << ", " << hash.a2 << ")";
+		}
+
+	private:
+		static point<d, IndexInt> shift(const point<d, PosInt>& p,
+			const point<d, uint64_t>& a, const point<d, uint64_t>& b)
+		{
+			point<d, IndexInt> output;
+			for (uint i = 0; i < d; i++)
+			{
+				output[i] = (a[i] * p[i] + b[i]) >> (64 - bits);
+			}
+			return output;
+		}
+	};
+
+	// hashes the Morton (Z-curve) code of a point, d * bits of PosInt must fit in 64 bits
+	// h0 is the Morton code itself, so points that are close in the domain tend to be
+	// close in the hash table too, h1 and the positional hash are multiply-shift hashes of it
+	template<uint d, class PosInt, class HashInt>
+	class morton_hash
+	{
+		using IndexInt = size_t;
+
+		uint64_t a1;
+		uint64_t a2;
+		uint64_t b2;
+
+	public:
+		morton_hash() : a1(1), a2(1), b2(0) { }
+		constexpr morton_hash(uint64_t a1, uint64_t a2, uint64_t b2) : a1(a1), a2(a2), b2(b2) { }
+
+		template<class Generator>
+		void pick(Generator& generator)
+		{
+			std::uniform_int_distribution<uint64_t> dist;
+			a1 = dist(generator) | 1;
+			a2 = dist(generator) | 1;
+			b2 = dist(generator);
+		}
+
+		// the code goes in the last coordinate, which is the least significant in point_to_index
+		point<d, IndexInt> h0(const point<d, PosInt>& p) const
+		{
+			point<d, IndexInt> output;
+			output[d - 1] = morton_code(p);
+			return output;
+		}
+		point<d, IndexInt> h1(const point<d, PosInt>& p) const
+		{
+			point<d, IndexInt> output;
+			output[d - 1] = (morton_code(p) * a1) >> 32;
+			return output;
+		}
+		HashInt hk(const point<d, PosInt>& p, HashInt k) const
+		{
+			return HashInt((morton_code(p) * (a2 + 2 * b2 * k)) >> (64 - sizeof(HashInt) * 8));
+		}
+
+		point<d, IndexInt> h0_limit(const point<d, PosInt>& u_bar) const
+		{
+			// every coordinate in the domain fits in as many bits as the widest limit
+			uint width = 0;
+			for (uint i = 0; i < d; i++)
+			{
+				while (width < sizeof(PosInt) * 8 && (IndexInt(u_bar[i]) >> width) != 0)
+				{
+					width++;
+				}
+			}
+			point<d, IndexInt> output;
+			output[d - 1] = d * width >= 64 ? ~IndexInt(0) : IndexInt(1) << (d * width);
+			return output;
+		}
+
+		void write_source(std::ostream& stream) const
+		{
+			stream << source_literal(a1) << ", " << source_literal(a2) << ", " << source_literal(b2);
+		}
+
+		friend std::ostream& operator<<(std::ostream& stream, const morton_hash& hash)
+		{
+			return stream << "(" << hash.a1 << ", " << hash.a2 << ")";
+		}
+	};
+}
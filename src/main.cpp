@@ -1,10 +1,42 @@
 #include "psh.hpp"
+#include "chunked_map.hpp"
+#include "packed_map.hpp"
+#include "concurrent_map.hpp"
+#include "automaton.hpp"
+#include "sparse_volume.hpp"
+#include "texture_map.hpp"
+#include "mapped_map.hpp"
+#include "multi_map.hpp"
+#include "static_map.hpp"
 #include <experimental/optional>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <new>
 #include <iostream>
+#include <map>
 #include <chrono>
 #include <stdint.h>
 #include <thread>
 
+// every allocation of the program is counted, see allocation_test
+std::atomic<size_t> allocations(0);
+void* operator new(size_t size)
+{
+	allocations++;
+	if (auto output = std::malloc(size))
+		return output;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
 struct dumb
 {
 	union
@@ -92,6 +124,8 @@ void voxel_test()
 	std::cout << "original data: " << (original_data_size / (1024 * 1024.0f)) << " mb" << std::endl;
 
 	std::cout << "class size: " << s.memory_size() / (1024 * 1024.0f) << " mb" << std::endl;
+	std::cout << "peak construction memory: " << s.build_memory_size() / (1024 * 1024.0f)
+		<< " mb" << std::endl;
 
 	std::cout << "compression factor vs dense: " << (float(s.memory_size())
 		/ (uint(std::pow(width, 3)) * sizeof(voxel))) << std::endl;
@@ -169,6 +203,10 @@ void game_of_life_test()
 	std::cout << "original data: " << (original_data_size / (1024 * 1024.0f)) << " mb" << std::endl;
 
 	std::cout << "class size: " << s.memory_size() / (1024 * 1024.0f) << " mb" << std::endl;
+	psh::packed_map<d, pixel, PosInt, HashInt> packed(s);
+	std::cout << "packed class size: " << packed.memory_size() / (1024 * 1024.0f) << " mb, "
+		<< packed.entry_bits() << " bits per entry, "
+		<< packed.offset_bits() << " bits per offset" << std::endl;
 
 	std::cout << "compression factor vs dense: " << (float(s.memory_size())
 		/ (uint(std::pow(width, 3)) * sizeof(pixel))) << std::endl;
@@ -206,52 +244,20 @@ void game_of_life_test()
 		});
 	std::cout << "finished!" << std::endl;
 
-	std::unordered_map<psh::point<d, PosInt>, pixel> queue;
-	bool add_failed = false;
-	auto insert = [&](const psh::point<d, PosInt>& p, bool value)
-		{
-			if (!add_failed)
-			{
-				try
-				{
-					auto& found = s.get(p);
-					found = value;
-				}
-				catch (const std::out_of_range& e)
-				{
-					if (!s.add(p, value))
-					{
-						add_failed = true;
-						std::cout << "failed.." << std::endl;
-					}
-				}
-			}
-
-			if (add_failed)
-			{
-				queue[p] = value;
-			}
-		};
+	// every frame's changes are collected and applied as a single batch
+	std::vector<map::data_t> updates;
 	uint num_rebuilds = 0;
 	auto finalize = [&]()
 		{
-			if (add_failed)
-			{
-				std::vector<map::data_t> new_data;
-				new_data.reserve(queue.size());
-				for (auto& kvp : queue)
+			auto summary = s.apply_updates([&](size_t i)
 				{
-					new_data.push_back(map::data_t{kvp.first, kvp.second});
-				}
-
-				s = s.rebuild([&](size_t i)
-					{
-						return new_data[i];
-					}, queue.size(), data_b);
-				queue.clear();
-				add_failed = false;
+					return updates[i];
+				}, updates.size());
+			updates.clear();
+			if (summary.rebuilt != 0)
 				num_rebuilds++;
-			}
+			std::cout << summary.overwritten << " overwritten, " << summary.added << " added, "
+				<< summary.repaired << " repaired, " << summary.rebuilt << " rebuilt" << std::endl;
 			std::cout << num_rebuilds << " rebuilds so far, memory use: "
 				<< s.memory_size() / (1024 * 1024.0f) << "mb" << std::endl << std::endl;
 		};
@@ -302,7 +308,7 @@ void game_of_life_test()
 					}
 					else if (num_neighbours == 3)
 						alive = true;
-					insert(p, alive);
+					updates.push_back(map::data_t{p, alive});
 				}
 			}
 		}
@@ -312,33 +318,1684 @@ void game_of_life_test()
 
 		finalize();
 		//s = s.rebuild([](size_t i) { return map::data_t(); }, 0, data_b);
+		// only visit the stored cells instead of probing the whole grid
+		std::vector<bool> screen(width * width);
+		for (auto e : s)
+		{
+			if (e.contents)
+				screen[e.location[1] * width + e.location[0]] = true;
+		}
 		for (PosInt y = 0; y < width; y++)
 		{
 			std::cout << std::endl;
 			for (PosInt x = 0; x < width; x++)
 			{
-				auto p = psh::point<d, PosInt>{x, y};
-				try
+				std::cout << (screen[y * width + x] ? "▮" : " ");
+			}
+		}
+		std::cout << std::endl;
+		std::this_thread::sleep_for(200ms);
+	}
+}
+
+void chunked_map_test()
+{
+	using pixel = bool;
+	const uint d = 2;
+	using PosInt = uint8_t;
+	// chunks at the edge of the data can be very sparse, so the positional hash needs more bits
+	using HashInt = uint16_t;
+	using map = psh::chunked_map<d, pixel, PosInt, HashInt>;
+	using point = map::global_point;
+
+	PosInt chunk_width = 32;
+	int radius = 100;
+	std::vector<map::data_t> data;
+	std::unordered_map<point, pixel> reference;
+	for (int x = -radius; x < radius; x++)
+	{
+		for (int y = -radius; y < radius; y++)
+		{
+			if (rand() % 20 == 0)
+			{
+				data.push_back(map::data_t{point{x, y}, pixel{true}});
+				reference[point{x, y}] = true;
+			}
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	map s(chunk_width);
+	auto start_time = std::chrono::high_resolution_clock::now();
+	s.insert(data);
+	auto stop_time = std::chrono::high_resolution_clock::now();
+
+	std::cout << "chunks: " << s.num_chunks() << std::endl;
+	std::cout << "class size: " << s.memory_size() / (1024 * 1024.0f) << " mb" << std::endl;
+	std::cout << "map creation time: " << std::endl;
+	std::cout << std::chrono::duration_cast<std::chrono::milliseconds>
+		(stop_time - start_time).count() / 1000.0f << " seconds" << std::endl;
+
+	// grow the world outside of the existing chunks and evict one of the old ones
+	std::vector<map::data_t> more{map::data_t{point{5 * radius, -5 * radius}, pixel{true}}};
+	reference[more[0].location] = true;
+	s.insert(more);
+	s.evict(point{0, 0});
+	for (auto it = reference.begin(); it != reference.end();)
+	{
+		if (s.chunk_of(it->first) == point{0, 0})
+			it = reference.erase(it);
+		else
+			++it;
+	}
+
+	std::cout << "exhaustive test" << std::endl;
+	map::cursor c(s);
+	for (int x = -radius; x < radius; x++)
+	{
+		for (int y = -radius; y < radius; y++)
+		{
+			point p{x, y};
+			auto exists = reference.count(p) != 0;
+			try
+			{
+				c.get(p);
+				if (!exists)
+				{
+					std::cout << "found non-existing element!" << std::endl;
+					std::cout << p << std::endl;
+				}
+			}
+			catch (const std::out_of_range& e)
+			{
+				if (exists)
+				{
+					std::cout << "didn't find existing element!" << std::endl;
+					std::cout << p << std::endl;
+				}
+			}
+		}
+	}
+	if (!s.get(more[0].location))
+		std::cout << "didn't find element in new chunk!" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+void lookup_stream_test()
+{
+	using voxel = voxelgroup;
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, voxel, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	PosInt width = 200;
+	std::vector<map::data_t> data;
+	for (uint i = 0; i < uint(width * width * width); i++)
+	{
+		if (rand() % 10 == 0)
+		{
+			point p = psh::index_to_point<d>(i, width, uint(-1));
+			data.push_back(map::data_t{p, voxel{uint16_t(i)}});
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	map s([&](size_t i) { return data[i]; }, data.size(), width);
+	std::cout << "class size: " << s.memory_size() / (1024 * 1024.0f) << " mb" << std::endl;
+
+	// random order, so that every lookup is a cache miss once the map is larger than the cache
+	std::vector<point> queries;
+	queries.reserve(data.size() * 4);
+	for (uint i = 0; i < data.size() * 4; i++)
+	{
+		queries.push_back(data[rand() % data.size()].location);
+	}
+
+	uint found = 0;
+	auto start_time = std::chrono::high_resolution_clock::now();
+	for (auto& p : queries)
+	{
+		found += s.get(p).voxels[0] != 1;
+	}
+	auto stop_time = std::chrono::high_resolution_clock::now();
+	std::cout << "get: " << std::chrono::duration_cast<std::chrono::nanoseconds>
+		(stop_time - start_time).count() / float(queries.size()) << " ns per lookup" << std::endl;
+
+	for (size_t distance : {1, 2, 4, 8, 16, 32})
+	{
+		start_time = std::chrono::high_resolution_clock::now();
+		s.lookup_stream(queries.begin(), queries.end(), [&](const point& p, voxel* contents)
+			{
+				if (contents == nullptr)
+				{
+					std::cout << "didn't find existing element!" << std::endl;
+					std::cout << p << std::endl;
+				}
+				else
+					found += contents->voxels[0] != 1;
+			}, distance);
+		stop_time = std::chrono::high_resolution_clock::now();
+		std::cout << "lookup_stream, distance " << distance << ": "
+			<< std::chrono::duration_cast<std::chrono::nanoseconds>
+			(stop_time - start_time).count() / float(queries.size()) << " ns per lookup" << std::endl;
+	}
+	std::cout << "finished! (" << found << ")" << std::endl;
+}
+
+// returns the number of errors, so that a caller can fail on them
+uint concurrent_map_test()
+{
+	// both halves are always written together, so a reader that sees them differ saw a torn write
+	struct pair_value
+	{
+		uint32_t a;
+		uint32_t b;
+	};
+	const uint d = 2;
+	using PosInt = uint16_t;
+	using HashInt = uint16_t;
+	using map = psh::map<d, pair_value, PosInt, HashInt>;
+	using concurrent_map = psh::concurrent_map<d, pair_value, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	PosInt width = 512;
+	std::vector<map::data_t> data;
+	for (uint i = 0; i < uint(width * width); i++)
+	{
+		if (rand() % 10 == 0)
+		{
+			point p = psh::index_to_point<d>(i, width, uint(-1));
+			data.push_back(map::data_t{p, pair_value{i, i}});
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	concurrent_map s(map([&](size_t i) { return data[i]; }, data.size(), width));
+	const uint num_threads = std::max(2u, std::thread::hardware_concurrency());
+	const uint num_ops = 200000;
+
+	std::cout << "stress test, " << num_threads << " threads" << std::endl;
+	std::atomic<uint> errors(0);
+	std::vector<std::vector<point>> added(num_threads);
+	std::vector<std::thread> threads;
+	for (uint t = 0; t < num_threads; t++)
+	{
+		threads.emplace_back([&, t]()
+			{
+				std::default_random_engine generator(t);
+				std::uniform_int_distribution<size_t> pick(0, data.size() - 1);
+				std::uniform_int_distribution<PosInt> coordinate(0, width - 1);
+				for (uint i = 0; i < num_ops; i++)
 				{
-					if (s.get(p))
+					auto& p = data[pick(generator)].location;
+					// even threads read, odd threads write
+					if (t % 2 == 0)
+					{
+						pair_value found;
+						if (!s.find(p, found))
+						{
+							std::cout << "didn't find existing element!" << std::endl;
+							errors++;
+						}
+						else if (found.a != found.b)
+						{
+							std::cout << "torn read!" << std::endl;
+							errors++;
+						}
+					}
+					else if (i % 4 != 0)
 					{
-						std::cout << "▮";
+						if (!s.set(p, pair_value{i, i}))
+						{
+							std::cout << "couldn't update existing element!" << std::endl;
+							errors++;
+						}
 					}
 					else
-						throw std::out_of_range("");
+					{
+						point q{coordinate(generator), coordinate(generator)};
+						if (s.add(q, pair_value{i, i}))
+							added[t].push_back(q);
+					}
 				}
-				catch (const std::out_of_range& e)
+			});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	// every element that was added has to be there, and nothing else may have appeared,
+	// neither before release nor after it, when the positional hashes decide
+	std::vector<bool> data_b(width * width);
+	for (auto& e : data)
+	{
+		data_b[psh::point_to_index<d>(e.location, width, uint(-1))] = true;
+	}
+	for (auto& points : added)
+	{
+		for (auto& p : points)
+		{
+			data_b[psh::point_to_index<d>(p, width, uint(-1))] = true;
+		}
+	}
+	std::vector<point> domain;
+	for (uint i = 0; i < uint(width * width); i++)
+	{
+		point p = psh::index_to_point<d>(i, width, uint(-1));
+		domain.push_back(p);
+		pair_value found;
+		if (s.find(p, found) != data_b[i])
+		{
+			std::cout << (data_b[i] ? "didn't find added element!" : "found element that isn't stored!")
+				<< std::endl;
+			errors++;
+		}
+	}
+	auto result = s.release();
+	uint j = 0;
+	result.lookup_stream(domain.begin(), domain.end(), [&](const point&, const pair_value* contents)
+		{
+			if ((contents != nullptr) != data_b[j])
+			{
+				std::cout << "released map disagrees at " << domain[j] << std::endl;
+				errors++;
+			}
+			j++;
+		});
+	size_t iterated = 0;
+	for (auto e : result)
+	{
+		iterated++;
+		if (e.contents.a != e.contents.b)
+			errors++;
+	}
+	if (iterated != result.size())
+	{
+		std::cout << "size is " << result.size() << ", but iterated over " << iterated << std::endl;
+		errors++;
+	}
+	std::cout << errors << " errors" << std::endl;
+
+	std::cout << "throughput, 90% reads and 10% writes" << std::endl;
+	concurrent_map bench(std::move(result));
+	for (uint n = 1; n <= num_threads; n++)
+	{
+		threads.clear();
+		auto start_time = std::chrono::high_resolution_clock::now();
+		for (uint t = 0; t < n; t++)
+		{
+			threads.emplace_back([&, t]()
+				{
+					std::default_random_engine generator(t);
+					std::uniform_int_distribution<size_t> pick(0, data.size() - 1);
+					pair_value found;
+					for (uint i = 0; i < num_ops; i++)
+					{
+						auto& p = data[pick(generator)].location;
+						if (i % 10 == 0)
+							bench.set(p, pair_value{i, i});
+						else
+							bench.find(p, found);
+					}
+				});
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		auto stop_time = std::chrono::high_resolution_clock::now();
+		auto seconds = std::chrono::duration_cast<std::chrono::nanoseconds>
+			(stop_time - start_time).count() / 1e9f;
+		std::cout << n << " threads: " << n * num_ops / seconds / 1e6f << " million ops/s" << std::endl;
+	}
+	std::cout << "finished!" << std::endl;
+	return errors;
+}
+
+void automaton_test()
+{
+	const uint d = 2;
+	using PosInt = uint8_t;
+	using HashInt = uint16_t;
+	using automaton = psh::automaton<d, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	// a dense copy of the grid is stepped alongside as a reference
+	PosInt width = 64;
+	std::vector<bool> reference(width * width);
+	std::vector<point> live;
+	for (PosInt y = 0; y < width; y++)
+	{
+		for (PosInt x = 0; x < width; x++)
+		{
+			if (rand() % 5 == 0)
+			{
+				live.push_back(point{x, y});
+				reference[y * width + x] = true;
+			}
+		}
+	}
+
+	automaton life(point::repeating(width), live, automaton::life);
+	uint errors = 0;
+	for (uint generation = 0; generation < 50; generation++)
+	{
+		auto start_time = std::chrono::high_resolution_clock::now();
+		life.step();
+		auto stop_time = std::chrono::high_resolution_clock::now();
+
+		std::vector<bool> next(width * width);
+		for (int y = 0; y < width; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				uint neighbours = 0;
+				for (int y_off = y - 1; y_off <= y + 1; y_off++)
 				{
-					std::cout << " ";
+					for (int x_off = x - 1; x_off <= x + 1; x_off++)
+					{
+						if ((x_off != x || y_off != y) && x_off >= 0 && y_off >= 0
+							&& x_off < width && y_off < width && reference[y_off * width + x_off])
+							neighbours++;
+					}
 				}
+				next[y * width + x] = automaton::life(reference[y * width + x], neighbours);
 			}
 		}
-		std::cout << std::endl;
-		std::this_thread::sleep_for(200ms);
+		reference = next;
+
+		for (PosInt y = 0; y < width; y++)
+		{
+			for (PosInt x = 0; x < width; x++)
+			{
+				if (life.alive(point{x, y}) != reference[y * width + x])
+					errors++;
+			}
+		}
+		std::cout << "generation " << life.generations() << ": " << life.population()
+			<< " alive, step took " << std::chrono::duration_cast<std::chrono::microseconds>
+			(stop_time - start_time).count() / 1000.0f << " ms" << std::endl;
+	}
+
+	// a few gliders on a large grid, where a step should take about as long as on a small one,
+	// since neither the step nor the maps look at the empty part of the grid
+	{
+		using PosInt = uint16_t;
+		using automaton = psh::automaton<d, PosInt, HashInt>;
+		using point = psh::point<d, PosInt>;
+
+		PosInt width = 4096;
+		std::vector<point> gliders;
+		for (uint i = 0; i < 8; i++)
+		{
+			for (auto& offset : {point{1, 0}, point{2, 1}, point{0, 2}, point{1, 2}, point{2, 2}})
+			{
+				gliders.push_back(point{PosInt(100 + i * 400 + offset[0]), PosInt(100 + i * 300 + offset[1])});
+			}
+		}
+
+		automaton large(point::repeating(width), gliders, automaton::life);
+		const uint steps = 100;
+		auto start_time = std::chrono::high_resolution_clock::now();
+		for (uint generation = 0; generation < steps; generation++)
+		{
+			large.step();
+		}
+		auto stop_time = std::chrono::high_resolution_clock::now();
+
+		// a glider moves one cell diagonally every 4 generations
+		if (large.population() != gliders.size())
+			errors++;
+		for (auto& p : gliders)
+		{
+			if (!large.alive(point{PosInt(p[0] + steps / 4), PosInt(p[1] + steps / 4)}))
+				errors++;
+		}
+		std::cout << "gliders on a " << width << "x" << width << " grid: step took "
+			<< std::chrono::duration_cast<std::chrono::microseconds>
+			(stop_time - start_time).count() / 1000.0f / steps << " ms" << std::endl;
 	}
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
 }
 
-int main( int argc, const char* argv[] )
+// a plain integer DDA that looks up every brick it passes, as a reference for raycast
+template<uint d, class T, class PosInt, class HashInt>
+bool reference_raycast(const psh::sparse_volume<d, T, PosInt, HashInt>& v, const psh::point<d, PosInt>& u_bar,
+	const psh::point<d, float>& origin, const psh::point<d, float>& direction, psh::point<d, PosInt>& output)
+{
+	const double infinity = std::numeric_limits<double>::infinity();
+	double t = 0;
+	double t_end = infinity;
+	for (uint j = 0; j < d; j++)
+	{
+		if (direction[j] == 0)
+		{
+			if (origin[j] < 0 || origin[j] >= u_bar[j])
+				return false;
+			continue;
+		}
+		double t0 = -double(origin[j]) / direction[j];
+		double t1 = (double(u_bar[j]) - origin[j]) / direction[j];
+		t = std::max(t, std::min(t0, t1));
+		t_end = std::min(t_end, std::max(t0, t1));
+	}
+	if (t >= t_end)
+		return false;
+
+	psh::point<d, PosInt> p;
+	double t_max[d];
+	double t_delta[d];
+	for (uint j = 0; j < d; j++)
+	{
+		double x = std::floor(origin[j] + double(direction[j]) * t);
+		p[j] = PosInt(std::min(std::max(x, 0.0), double(u_bar[j] - 1)));
+		t_delta[j] = direction[j] == 0 ? infinity : 1 / std::abs(double(direction[j]));
+		t_max[j] = direction[j] == 0 ? infinity
+			: (p[j] + (direction[j] > 0 ? 1 : 0) - double(origin[j])) / direction[j];
+	}
+	while (true)
+	{
+		if (v.contents().contains(p))
+		{
+			output = p;
+			return true;
+		}
+		uint a = 0;
+		for (uint j = 1; j < d; j++)
+		{
+			if (t_max[j] < t_max[a])
+				a = j;
+		}
+		if (t_max[a] == infinity)
+			return false;
+		if (direction[a] > 0 ? p[a] + 1 >= u_bar[a] : p[a] == 0)
+			return false;
+		p[a] += direction[a] > 0 ? 1 : -1;
+		t_max[a] += t_delta[a];
+	}
+}
+
+// where a ray passes (almost) exactly through an edge or a corner, float and double
+// can disagree on which of the bricks around it comes first, so neighbours count too
+template<uint d, class PosInt>
+bool same_hit(const psh::point<d, PosInt>& lhs, const psh::point<d, PosInt>& rhs)
+{
+	for (uint j = 0; j < d; j++)
+	{
+		if (std::abs(int(lhs[j]) - int(rhs[j])) > 1)
+			return false;
+	}
+	return true;
+}
+
+void sparse_volume_test()
 {
+	using voxel = voxelgroup;
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint16_t;
+	using volume = psh::sparse_volume<d, voxel, PosInt, HashInt>;
+	using map = volume::map;
+	using point = psh::point<d, PosInt>;
+	using position = volume::position;
+
+	// a few solid balls in an otherwise empty volume, so there's plenty of space to skip
+	PosInt width = 128;
+	std::vector<map::data_t> data;
+	std::vector<bool> data_b(width * width * width);
+	std::vector<std::pair<position, float>> balls;
+	for (uint i = 0; i < 12; i++)
+	{
+		balls.emplace_back(position{float(rand() % width), float(rand() % width), float(rand() % width)},
+			4.0f + rand() % 8);
+	}
+	for (uint i = 0; i < uint(width * width * width); i++)
+	{
+		point p = psh::index_to_point<d>(i, width, uint(-1));
+		for (auto& ball : balls)
+		{
+			float distance = 0;
+			for (uint j = 0; j < d; j++)
+			{
+				distance += (p[j] - ball.first[j]) * (p[j] - ball.first[j]);
+			}
+			if (distance <= ball.second * ball.second)
+			{
+				data.push_back(map::data_t{p, voxel{uint16_t(i)}});
+				data_b[i] = true;
+				break;
+			}
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	volume v(map([&](size_t i) { return data[i]; }, data.size(), width), point::repeating(width));
+	std::cout << "class size: " << v.memory_size() / (1024 * 1024.0f) << " mb, "
+		<< v.num_levels() << " levels" << std::endl;
+
+	uint errors = 0;
+	std::cout << "box queries" << std::endl;
+	for (uint i = 0; i < 100; i++)
+	{
+		point min;
+		point max;
+		for (uint j = 0; j < d; j++)
+		{
+			auto a = rand() % (width + 1);
+			auto b = rand() % (width + 1);
+			min[j] = std::min(a, b);
+			max[j] = std::max(a, b);
+		}
+		size_t expected = 0;
+		for (uint x = min[0]; x < max[0]; x++)
+			for (uint y = min[1]; y < max[1]; y++)
+				for (uint z = min[2]; z < max[2]; z++)
+					expected += data_b[psh::point_to_index<d>(point{PosInt(x), PosInt(y), PosInt(z)},
+						width, uint(-1))];
+		size_t found = 0;
+		v.query_box(min, max, [&](const point& p, const voxel& contents)
+			{
+				if (contents.voxels[0] != uint16_t(psh::point_to_index<d>(p, width, uint(-1))))
+					errors++;
+				found++;
+			});
+		if (found != expected)
+		{
+			std::cout << "box " << min << " - " << max << ": expected " << expected
+				<< ", found " << found << std::endl;
+			errors++;
+		}
+	}
+
+	auto dda = [&](const position& origin, const position& direction, point& output)
+		{
+			return reference_raycast(v, point::repeating(width), origin, direction, output);
+		};
+
+	std::cout << "raycasts" << std::endl;
+	// rays that don't start on a grid and don't have integer directions, since those keep
+	// passing exactly through corners, where any of the bricks around it is a valid hit
+	auto random_float = [](float limit)
+		{
+			return limit * (rand() / (RAND_MAX + 1.0f));
+		};
+	std::vector<std::pair<position, position>> rays;
+	for (uint i = 0; i < 20000; i++)
+	{
+		position origin{random_float(width), random_float(width), random_float(width)};
+		position direction{random_float(200) - 100, random_float(200) - 100, random_float(200) - 100};
+		rays.emplace_back(origin, direction);
+	}
+
+	uint hits = 0;
+	auto start_time = std::chrono::high_resolution_clock::now();
+	for (auto& ray : rays)
+	{
+		volume::hit h;
+		hits += v.raycast(ray.first, ray.second, h);
+	}
+	auto stop_time = std::chrono::high_resolution_clock::now();
+	std::cout << "raycast: " << std::chrono::duration_cast<std::chrono::nanoseconds>
+		(stop_time - start_time).count() / float(rays.size()) << " ns per ray, "
+		<< hits << " hits" << std::endl;
+
+	hits = 0;
+	start_time = std::chrono::high_resolution_clock::now();
+	for (auto& ray : rays)
+	{
+		point p;
+		hits += dda(ray.first, ray.second, p);
+	}
+	stop_time = std::chrono::high_resolution_clock::now();
+	std::cout << "plain dda: " << std::chrono::duration_cast<std::chrono::nanoseconds>
+		(stop_time - start_time).count() / float(rays.size()) << " ns per ray, "
+		<< hits << " hits" << std::endl;
+
+	for (auto& ray : rays)
+	{
+		volume::hit h;
+		point p;
+		bool found = v.raycast(ray.first, ray.second, h);
+		if (found != dda(ray.first, ray.second, p) || (found && !same_hit(h.location, p)))
+			errors++;
+	}
+
+	// far from the origin a float can't represent a small step along the ray anymore,
+	// which is where a traversal that nudges t instead of stepping bricks gets stuck
+	{
+		using PosInt = uint16_t;
+		using volume = psh::sparse_volume<2, voxel, PosInt, HashInt>;
+		using map = volume::map;
+		using point = psh::point<2, PosInt>;
+		using position = volume::position;
+
+		PosInt width = 3000;
+		std::vector<map::data_t> data;
+		for (uint i = 0; i < 40; i++)
+		{
+			int cx = rand() % width;
+			int cy = rand() % width;
+			int radius = 10 + rand() % 60;
+			for (int x = std::max(0, cx - radius); x < std::min(int(width), cx + radius); x++)
+				for (int y = std::max(0, cy - radius); y < std::min(int(width), cy + radius); y++)
+					if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= radius * radius)
+						data.push_back(map::data_t{point{PosInt(x), PosInt(y)}, voxel{uint16_t(x)}});
+		}
+		volume large(map([&](size_t i) { return data[i]; }, data.size(), width), point::repeating(width));
+
+		std::vector<std::pair<position, position>> large_rays{{{2103.8f, 2341.1f}, {-0.78f, 0.66f}}};
+		for (uint i = 0; i < 2000; i++)
+		{
+			large_rays.emplace_back(position{random_float(width), random_float(width)},
+				position{random_float(200) - 100, random_float(200) - 100});
+		}
+		for (auto& ray : large_rays)
+		{
+			volume::hit h;
+			point p;
+			bool found = large.raycast(ray.first, ray.second, h);
+			if (found != reference_raycast(large, point::repeating(width), ray.first, ray.second, p)
+				|| (found && !same_hit(h.location, p)))
+				errors++;
+		}
+	}
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+void prefilter_test()
+{
+	using voxel = voxelgroup;
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, voxel, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	// 10% density, so 90% of an exhaustive sweep are misses
+	PosInt width = 128;
+	std::vector<map::data_t> data;
+	std::vector<bool> data_b(width * width * width);
+	for (uint i = 0; i < uint(width * width * width); i++)
+	{
+		if (rand() % 10 == 0)
+		{
+			point p = psh::index_to_point<d>(i, width, uint(-1));
+			data.push_back(map::data_t{p, voxel{uint16_t(i)}});
+			data_b[i] = true;
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	map s([&](size_t i) { return data[i]; }, data.size(), width);
+
+	// every point in the domain once, in random order
+	std::vector<uint> queries(data_b.size());
+	std::iota(queries.begin(), queries.end(), 0);
+	std::shuffle(queries.begin(), queries.end(), std::default_random_engine(0));
+	std::vector<point> points;
+	points.reserve(queries.size());
+	for (auto i : queries)
+	{
+		points.push_back(psh::index_to_point<d>(i, width, uint(-1)));
+	}
+
+	for (auto kind : {psh::prefilter_kind::none, psh::prefilter_kind::bitmap, psh::prefilter_kind::bloom})
+	{
+		s.use_prefilter(kind);
+		uint errors = 0;
+		auto start_time = std::chrono::high_resolution_clock::now();
+		for (uint i = 0; i < points.size(); i++)
+		{
+			if (s.contains(points[i]) != data_b[queries[i]])
+				errors++;
+		}
+		auto stop_time = std::chrono::high_resolution_clock::now();
+		std::cout << "prefilter " << int(kind) << ": " << s.prefilter_memory_size() / 1024.0f << " kb, "
+			<< std::chrono::duration_cast<std::chrono::nanoseconds>
+			(stop_time - start_time).count() / float(points.size()) << " ns per probe, "
+			<< errors << " errors" << std::endl;
+	}
+	std::cout << "finished!" << std::endl;
+}
+
+void texture_map_test()
+{
+	using voxel = voxelgroup;
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, voxel, PosInt, HashInt>;
+	using texture = psh::texture_map<d, voxel, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	PosInt width = 128;
+	std::vector<map::data_t> data;
+	for (uint i = 0; i < uint(width * width * width); i++)
+	{
+		if (rand() % 10 == 0)
+		{
+			point p = psh::index_to_point<d>(i, width, uint(-1));
+			data.push_back(map::data_t{p, voxel{uint16_t(i)}});
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	map s([&](size_t i) { return data[i]; }, data.size(), width);
+
+	// stored points, once in random order and once sweeping blocks of 4^3 bricks,
+	// the access pattern a shader sampling a region of the volume would have
+	std::vector<point> random_order;
+	for (auto& e : data)
+	{
+		random_order.push_back(e.location);
+	}
+	std::shuffle(random_order.begin(), random_order.end(), std::default_random_engine(0));
+	std::vector<point> coherent;
+	for (uint b = 0; b < uint(width * width * width); b += 64)
+	{
+		auto block = psh::index_to_point<d>(b / 64, PosInt(width / 4), uint(-1));
+		for (uint i = 0; i < 64; i++)
+		{
+			auto offset = psh::index_to_point<d>(i, PosInt(4), uint(-1));
+			point p = block * PosInt(4) + offset;
+			if (s.contains(p))
+				coherent.push_back(p);
+		}
+	}
+
+	auto benchmark = [&](const char* name, size_t memory, auto lookup)
+		{
+			uint errors = 0;
+			for (auto& p : random_order)
+			{
+				auto contents = lookup(p);
+				if (contents == nullptr || *contents != s.get(p))
+					errors++;
+			}
+			std::cout << name << ": " << memory / 1024.0f << " kb, " << errors << " errors" << std::endl;
+
+			for (auto queries : {&random_order, &coherent})
+			{
+				uint sum = 0;
+				auto start_time = std::chrono::high_resolution_clock::now();
+				for (auto& p : *queries)
+				{
+					sum += lookup(p)->voxels[0];
+				}
+				auto stop_time = std::chrono::high_resolution_clock::now();
+				std::cout << name << (queries == &coherent ? " coherent: " : " random: ")
+					<< std::chrono::duration_cast<std::chrono::nanoseconds>
+					(stop_time - start_time).count() / float(queries->size()) << " ns per lookup, "
+					<< "checksum " << sum << std::endl;
+			}
+		};
+
+	benchmark("map", s.memory_size(), [&](const point& p) { return s.find(p); });
+	for (auto layout : {psh::texture_layout::linear, psh::texture_layout::tiled})
+	{
+		texture t(s, layout);
+		benchmark(layout == psh::texture_layout::tiled ? "tiled" : "linear", t.memory_size(),
+			[&](const point& p) { return t.find(p); });
+	}
+	std::cout << "finished!" << std::endl;
+}
+
+// builds a map with the given hash policy for each data set, and reports how often
+// an offset table size worked, the build time, the final offset table size and the lookup time
+template<class Hash>
+void hash_policy_benchmark(const char* name, uint width,
+	const std::vector<std::vector<psh::map<3, voxelgroup, uint8_t, uint8_t>::data_t>>& data_sets)
+{
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, voxelgroup, PosInt, HashInt, std::allocator<voxelgroup>, Hash>;
+	using point = psh::point<d, PosInt>;
+
+	for (auto& data : data_sets)
+	{
+		auto start_time = std::chrono::high_resolution_clock::now();
+		map s([&](size_t i) { return typename map::data_t{data[i].location, data[i].contents}; },
+			data.size(), width);
+		auto stop_time = std::chrono::high_resolution_clock::now();
+		auto build_time = std::chrono::duration_cast<std::chrono::milliseconds>
+			(stop_time - start_time).count();
+
+		// every point in the domain, in random order
+		std::vector<bool> data_b(width * width * width);
+		for (auto& e : data)
+		{
+			data_b[psh::point_to_index<d>(e.location, PosInt(width), uint(-1))] = true;
+		}
+		std::vector<uint> queries(data_b.size());
+		std::iota(queries.begin(), queries.end(), 0);
+		std::shuffle(queries.begin(), queries.end(), std::default_random_engine(0));
+		std::vector<point> points;
+		for (auto i : queries)
+		{
+			points.push_back(psh::index_to_point<d>(i, PosInt(width), uint(-1)));
+		}
+
+		// lookup_stream checks the positional hashes, unlike find, which compares the stored
+		// locations, so this is what tells whether the policy's hk separates every point
+		uint errors = 0;
+		uint j = 0;
+		start_time = std::chrono::high_resolution_clock::now();
+		s.lookup_stream(points.begin(), points.end(), [&](const point&, const voxelgroup* contents)
+			{
+				if ((contents != nullptr) != data_b[queries[j]]
+					|| (contents != nullptr && contents->voxels[0] != uint16_t(queries[j])))
+					errors++;
+				j++;
+			});
+		stop_time = std::chrono::high_resolution_clock::now();
+
+		std::cout << name << ": " << data.size() << " elements, "
+			<< "1 of " << s.build_attempts() << " offset table sizes worked, "
+			<< build_time << " ms to build, r=" << s.offset_table_size() << ", "
+			<< std::chrono::duration_cast<std::chrono::nanoseconds>
+			(stop_time - start_time).count() / float(points.size()) << " ns per lookup, "
+			<< errors << " errors" << std::endl;
+	}
+}
+
+void hash_policy_test()
+{
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, voxelgroup, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	// the same domain at a few densities
+	uint width = 64;
+	std::vector<std::vector<map::data_t>> data_sets;
+	for (uint density : {1, 10, 50})
+	{
+		std::vector<map::data_t> data;
+		for (uint i = 0; i < width * width * width; i++)
+		{
+			if (uint(rand() % 100) < density)
+			{
+				point p = psh::index_to_point<d>(i, PosInt(width), uint(-1));
+				data.push_back(map::data_t{p, voxelgroup{uint16_t(i)}});
+			}
+		}
+		data_sets.push_back(data);
+	}
+
+	hash_policy_benchmark<psh::prime_hash<d, PosInt, HashInt>>("prime", width, data_sets);
+	hash_policy_benchmark<psh::multiply_shift_hash<d, PosInt, HashInt>>("multiply-shift", width, data_sets);
+	hash_policy_benchmark<psh::morton_hash<d, PosInt, HashInt>>("morton", width, data_sets);
+	std::cout << "finished!" << std::endl;
+}
+
+// many small maps, e.g. one per chunk of a world, plus a few large ones, built with build_many
+// and one at a time, every map is checked against its data
+void build_many_test()
+{
+	const uint d = 2;
+	using PosInt = uint8_t;
+	using HashInt = uint16_t;
+	using map = psh::map<d, uint, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	PosInt width = 32;
+	std::vector<std::vector<map::data_t>> data(2000);
+	std::vector<map::build_input> inputs;
+	for (uint j = 0; j < data.size(); j++)
+	{
+		// every 500th map is nearly full, so it's built on its own
+		uint density = j % 500 == 0 ? 90 : 2 + rand() % 20;
+		for (uint i = 0; i < uint(width * width); i++)
+		{
+			if (uint(rand() % 100) < density)
+				data[j].push_back(map::data_t{psh::index_to_point<d>(i, width, uint(-1)), j * width * width + i});
+		}
+		auto& data_j = data[j];
+		inputs.push_back(map::build_input{[&data_j](size_t i) { return data_j[i]; }, data_j.size(),
+			point::repeating(width)});
+	}
+
+	// the builds print their progress, which would drown out everything else here
+	std::cout.setstate(std::ios::failbit);
+	auto start_time = std::chrono::high_resolution_clock::now();
+	auto maps = map::build_many(inputs, 512);
+	auto stop_time = std::chrono::high_resolution_clock::now();
+	auto many_time = std::chrono::duration_cast<std::chrono::milliseconds>(stop_time - start_time).count();
+
+	start_time = std::chrono::high_resolution_clock::now();
+	std::vector<map> single;
+	for (auto& input : inputs)
+	{
+		single.emplace_back(input.data, input.n, input.u_bar);
+	}
+	stop_time = std::chrono::high_resolution_clock::now();
+	auto single_time = std::chrono::duration_cast<std::chrono::milliseconds>(stop_time - start_time).count();
+	std::cout.clear();
+
+	uint errors = 0;
+	for (uint j = 0; j < data.size(); j++)
+	{
+		if (maps[j].size() != data[j].size())
+			errors++;
+		for (auto& e : data[j])
+		{
+			if (maps[j].get(e.location) != e.contents || single[j].get(e.location) != e.contents)
+				errors++;
+		}
+	}
+
+	std::cout << data.size() << " maps, build_many: " << many_time << " ms, one at a time: "
+		<< single_time << " ms" << std::endl;
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+// prints percentiles of per-lookup latencies, and a histogram with power of two bins
+void print_latencies(const char* name, std::vector<uint>& latencies)
+{
+	if (latencies.empty())
+		return;
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double q)
+		{
+			return latencies[std::min(latencies.size() - 1, size_t(q * latencies.size()))];
+		};
+	std::cout << name << ": " << latencies.size() << " lookups, p50 " << percentile(0.5)
+		<< " ns, p90 " << percentile(0.9) << " ns, p99 " << percentile(0.99)
+		<< " ns, p99.9 " << percentile(0.999) << " ns, max " << latencies.back() << " ns" << std::endl;
+	size_t first = 0;
+	for (uint limit = 16; first < latencies.size(); limit *= 2)
+	{
+		size_t last = std::upper_bound(latencies.begin(), latencies.end(), limit) - latencies.begin();
+		if (last != first)
+			std::cout << "\t<= " << limit << " ns: " << 100.0f * (last - first) / latencies.size()
+				<< "%" << std::endl;
+		first = last;
+	}
+}
+
+// times lookups one at a time, since the tail of the distribution is what matters here
+// the times include reading the clock, so they're only comparable to each other
+void lookup_latency_test()
+{
+	using voxel = voxelgroup;
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, voxel, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+	using clock = std::chrono::high_resolution_clock;
+
+	// 10% density, so 90% of an exhaustive sweep are misses
+	PosInt width = 128;
+	std::vector<map::data_t> data;
+	std::vector<bool> data_b(width * width * width);
+	for (uint i = 0; i < uint(width * width * width); i++)
+	{
+		if (rand() % 10 == 0)
+		{
+			point p = psh::index_to_point<d>(i, width, uint(-1));
+			data.push_back(map::data_t{p, voxel{uint16_t(i)}});
+			data_b[i] = true;
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	// a fixed seed, so that runs are comparable
+	map tiered([&](size_t i) { return data[i]; }, data.size(), point::repeating(width), map::workspace(), 0);
+	// without locations there's no occupancy bitmap and no fingerprints, so every lookup
+	// goes straight to the positional hashes in H, as a baseline for the tiers
+	map untiered([&](size_t i) { return data[i]; }, data.size(), point::repeating(width),
+		map::workspace(false, false, true, false), 0);
+
+	// every point in the domain once, in random order
+	std::vector<uint> queries(data_b.size());
+	std::iota(queries.begin(), queries.end(), 0);
+	std::shuffle(queries.begin(), queries.end(), std::default_random_engine(0));
+
+	uint errors = 0;
+	auto measure = [&](const map& s, const std::string& name)
+		{
+			// contains for every query, then get in a separate pass,
+			// so neither runs on a cache that the other one just warmed up
+			std::vector<uint> hits;
+			std::vector<uint> misses;
+			for (auto i : queries)
+			{
+				point p = psh::index_to_point<d>(i, width, uint(-1));
+				auto start_time = clock::now();
+				bool found = s.contains(p);
+				auto stop_time = clock::now();
+				(found ? hits : misses).push_back(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(stop_time - start_time).count());
+				if (found != data_b[i])
+					errors++;
+			}
+
+			// get throws on a miss, catching it is part of the time of a miss
+			std::vector<uint> get_hits;
+			std::vector<uint> get_misses;
+			for (auto i : queries)
+			{
+				point p = psh::index_to_point<d>(i, width, uint(-1));
+				bool found = true;
+				uint16_t contents = 0;
+				auto start_time = clock::now();
+				try
+				{
+					contents = s.get(p).voxels[0];
+				}
+				catch (const std::out_of_range&)
+				{
+					found = false;
+				}
+				auto stop_time = clock::now();
+				(found ? get_hits : get_misses).push_back(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(stop_time - start_time).count());
+				if (found != data_b[i] || (found && contents != uint16_t(i)))
+					errors++;
+			}
+
+			print_latencies((name + " get, hits").c_str(), get_hits);
+			print_latencies((name + " get, misses").c_str(), get_misses);
+			print_latencies((name + " contains, hits").c_str(), hits);
+			print_latencies((name + " contains, misses").c_str(), misses);
+		};
+	measure(tiered, "tiered");
+	measure(untiered, "untiered");
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+// builds with a memory budget far below the size of the data set, so the input is split
+// into several partitions and every size class is placed in several chunks
+void mapped_map_test()
+{
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::mapped_map<d, uint32_t, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	PosInt width = 64;
+	std::vector<bool> data_b(width * width * width);
+	size_t n = 0;
+	for (uint i = 0; i < uint(width * width * width); i++)
+	{
+		data_b[i] = rand() % 10 == 0;
+		n += data_b[i];
+	}
+	std::cout << "data size: " << n << std::endl;
+
+	auto data = [&](const std::function<void(const map::data_t&)>& sink)
+		{
+			for (uint i = 0; i < uint(width * width * width); i++)
+			{
+				if (data_b[i])
+					sink(map::data_t{psh::index_to_point<d>(i, width, uint(-1)), i});
+			}
+		};
+	map::build_options options;
+	options.memory_budget = 16 << 10;
+	options.seed = 0;
+	std::string path = "mapped_map_test.psh";
+	map::build(path, data, n, point::repeating(width), options);
+
+	uint errors = 0;
+	{
+		map s(path);
+		std::cout << "file size: " << s.file_size() / 1024.0f << " kb" << std::endl;
+		for (uint i = 0; i < uint(width * width * width); i++)
+		{
+			point p = psh::index_to_point<d>(i, width, uint(-1));
+			auto contents = s.find(p);
+			if ((contents != nullptr) != data_b[i] || (contents != nullptr && *contents != i))
+				errors++;
+		}
+		size_t stored = 0;
+		s.for_each([&](const point& p, uint32_t contents)
+			{
+				if (psh::point_to_index<d>(p, width, uint(-1)) != contents)
+					errors++;
+				stored++;
+			});
+		if (stored != n || s.size() != n)
+			errors++;
+	}
+
+	// a duplicate can't be placed with any offset table, so it's rejected
+	auto first = std::find(data_b.begin(), data_b.end(), true) - data_b.begin();
+	bool rejected = false;
+	try
+	{
+		map::build(path, [&](const std::function<void(const map::data_t&)>& sink)
+			{
+				data(sink);
+				sink(map::data_t{psh::index_to_point<d>(uint(first), width, uint(-1)), 0});
+			}, n + 1, point::repeating(width), options);
+	}
+	catch (const std::invalid_argument&)
+	{
+		rejected = true;
+	}
+	if (!rejected)
+		errors++;
+	std::remove(path.c_str());
+
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+// several values per point, e.g. particles per cell, compared with a std::multimap
+void multi_map_test()
+{
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::multi_map<d, uint, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	PosInt width = 64;
+	uint u = width * width * width;
+	std::vector<map::value_t> data;
+	std::multimap<uint, uint> reference;
+	for (uint i = 0; i < u / 2; i++)
+	{
+		// a few cells get most of the values
+		uint location = rand() % 4 == 0 ? rand() % 64 : rand() % u;
+		data.push_back(map::value_t{psh::index_to_point<d>(location, width, uint(-1)), i});
+		reference.emplace(location, i);
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	map s([&](size_t i) { return data[i]; }, data.size(), width);
+	std::cout << "points: " << s.size() << ", memory: " << s.memory_size() / 1024.0f << " kb" << std::endl;
+
+	uint errors = 0;
+	for (uint i = 0; i < u; i++)
+	{
+		point p = psh::index_to_point<d>(i, width, uint(-1));
+		auto expected = reference.equal_range(i);
+		if (expected.first == expected.second)
+		{
+			if (s.contains(p) || !s.find(p).empty())
+				errors++;
+			continue;
+		}
+		// the values of a point keep the order they were given in
+		auto values = s.get(p);
+		auto v = values.begin();
+		for (auto e = expected.first; e != expected.second; ++e, ++v)
+		{
+			if (v == values.end() || *v != e->second)
+				break;
+		}
+		if (v != values.end()
+			|| values.size() != static_cast<size_t>(std::distance(expected.first, expected.second)))
+			errors++;
+	}
+	if (s.num_values() != data.size())
+		errors++;
+
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+// the same data set with and without the per-slot locations, occupancy and fingerprints,
+// every point of the domain has to get the same answer from both
+void enumerable_test()
+{
+	using voxel = voxelgroup;
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, voxel, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	PosInt width = 64;
+	std::vector<map::data_t> data;
+	for (uint i = 0; i < uint(width * width * width); i++)
+	{
+		if (rand() % 10 == 0)
+		{
+			point p = psh::index_to_point<d>(i, width, uint(-1));
+			data.push_back(map::data_t{p, voxel{uint16_t(i)}});
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	map full([&](size_t i) { return data[i]; }, data.size(), point::repeating(width), map::workspace(), 0);
+	map lean([&](size_t i) { return data[i]; }, data.size(), point::repeating(width),
+		map::workspace(false, false, true, false), 0);
+	std::cout << "enumerable: " << full.memory_size() / 1024.0f << " kb, not enumerable: "
+		<< lean.memory_size() / 1024.0f << " kb" << std::endl;
+
+	uint errors = 0;
+	std::vector<point> points;
+	for (uint i = 0; i < uint(width * width * width); i++)
+	{
+		point p = psh::index_to_point<d>(i, width, uint(-1));
+		points.push_back(p);
+		auto expected = full.find(p);
+		auto contents = lean.find(p);
+		if ((contents != nullptr) != (expected != nullptr) || lean.contains(p) != full.contains(p)
+			|| (contents != nullptr && contents->voxels[0] != expected->voxels[0]))
+			errors++;
+		if (expected != nullptr && lean.get(p).voxels[0] != uint16_t(i))
+			errors++;
+	}
+	uint j = 0;
+	lean.lookup_stream(points.begin(), points.end(), [&](const point& p, const voxel* contents)
+		{
+			if ((contents != nullptr) != full.contains(p))
+				errors++;
+			j++;
+		});
+
+	// without the locations, there's nothing to iterate over
+	bool rejected = false;
+	try
+	{
+		lean.begin();
+	}
+	catch (const std::logic_error&)
+	{
+		rejected = true;
+	}
+	if (!rejected || j != points.size())
+		errors++;
+
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+// begin/end, for_each_parallel and export_morton each have to visit every stored element
+// exactly once, and add has to keep get exact for every point of the domain
+void iteration_test()
+{
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, uint, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	PosInt width = 32;
+	uint u = width * width * width;
+	std::vector<map::data_t> data;
+	std::vector<bool> data_b(u);
+	for (uint i = 0; i < u; i++)
+	{
+		if (rand() % 10 == 0)
+		{
+			data.push_back(map::data_t{psh::index_to_point<d>(i, width, uint(-1)), i});
+			data_b[i] = true;
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	map s([&](size_t i) { return data[i]; }, data.size(), width);
+
+	uint errors = 0;
+	// how often each point of the domain was visited, with its index as contents
+	auto check_visits = [&](const char* name, const std::vector<uint>& visits)
+		{
+			for (uint i = 0; i < u; i++)
+			{
+				if (visits[i] != (data_b[i] ? 1 : 0))
+				{
+					std::cout << name << " visited " << psh::index_to_point<d>(i, width, uint(-1))
+						<< " " << visits[i] << " times" << std::endl;
+					errors++;
+				}
+			}
+		};
+	auto visit = [&](std::vector<uint>& visits, const point& location, uint contents)
+		{
+			auto i = psh::point_to_index<d>(location, width, uint(-1));
+			if (contents != i)
+				errors++;
+			visits[i]++;
+		};
+
+	std::vector<uint> visits(u);
+	for (auto e : s)
+	{
+		visit(visits, e.location, e.contents);
+	}
+	check_visits("iteration", visits);
+
+	std::vector<std::atomic<uint>> parallel_visits(u);
+	s.for_each_parallel([&](const point& location, uint contents)
+		{
+			auto i = psh::point_to_index<d>(location, width, uint(-1));
+			if (contents == i)
+				parallel_visits[i]++;
+		});
+	std::copy(parallel_visits.begin(), parallel_visits.end(), visits.begin());
+	check_visits("for_each_parallel", visits);
+
+	std::fill(visits.begin(), visits.end(), 0);
+	auto sorted = s.export_morton();
+	for (uint j = 0; j < sorted.size(); j++)
+	{
+		visit(visits, sorted[j].location, sorted[j].contents);
+		if (j > 0 && psh::morton_code(sorted[j - 1].location) >= psh::morton_code(sorted[j].location))
+			errors++;
+	}
+	check_visits("export_morton", visits);
+
+	// add points one at a time, every lookup over the domain has to stay exact
+	std::vector<point> domain;
+	for (uint i = 0; i < u; i++)
+	{
+		domain.push_back(psh::index_to_point<d>(i, width, uint(-1)));
+	}
+	uint added = 0;
+	for (uint j = 0; j < 200; j++)
+	{
+		uint i = rand() % u;
+		if (!data_b[i] && s.add(domain[i], i))
+		{
+			data_b[i] = true;
+			added++;
+		}
+	}
+	uint k = 0;
+	s.lookup_stream(domain.begin(), domain.end(), [&](const point&, const uint* contents)
+		{
+			if ((contents != nullptr) != data_b[k] || (contents != nullptr && *contents != k))
+				errors++;
+			k++;
+		});
+	std::cout << "added " << added << " elements" << std::endl;
+
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+// looks p up with get, where a miss is false instead of std::out_of_range
+template<class Map, class Point, class T>
+bool get_or_miss(const Map& s, const Point& p, T& output)
+{
+	try
+	{
+		output = s.get(p);
+		return true;
+	}
+	catch (const std::out_of_range&)
+	{
+		return false;
+	}
+}
+
+// every point of the domain has to give the same answer from the packed copy as from the map:
+// the same contents if it's stored, and std::out_of_range otherwise
+// returns the number of points where they disagree, or where the map itself is wrong
+template<class Map, class Packed, uint d, class PosInt>
+uint compare_packed(const Map& s, const Packed& packed, const psh::point<d, PosInt>& u_bar)
+{
+	uint errors = 0;
+	size_t u = psh::volume(u_bar);
+	size_t hits = 0;
+	for (size_t i = 0; i < u; i++)
+	{
+		auto p = psh::index_to_point<d>(i, u_bar, u);
+		typename std::decay<decltype(s.get(p))>::type expected, contents;
+		bool stored = get_or_miss(s, p, expected);
+		if (get_or_miss(packed, p, contents) != stored || (stored && contents != expected))
+			errors++;
+		hits += stored;
+	}
+	if (hits != s.size())
+		errors++;
+	return errors;
+}
+
+// a packed copy of a map has to find every stored element, and nothing else,
+// with either encoding of the offset table
+void packed_map_test()
+{
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, uint, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	PosInt width = 64;
+	uint u = width * width * width;
+	std::vector<map::data_t> data;
+	for (uint i = 0; i < u; i++)
+	{
+		if (rand() % 10 == 0)
+			data.push_back(map::data_t{psh::index_to_point<d>(i, width, uint(-1)), i});
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	map s([&](size_t i) { return data[i]; }, data.size(), width);
+	uint errors = 0;
+	for (auto encoding : {psh::phi_encoding::linear, psh::phi_encoding::coordinates})
+	{
+		psh::packed_map<d, uint, PosInt, HashInt> packed(s, encoding);
+		std::cout << "packed: " << packed.memory_size() / 1024.0f << " kb, "
+			<< packed.entry_bits() << " bits per entry, "
+			<< packed.offset_bits() << " bits per offset" << std::endl;
+		if (packed.offset_encoding() != encoding)
+			errors++;
+		errors += compare_packed(s, packed, point::repeating(width));
+	}
+
+	// the Morton code of a point with a 16 bit coordinate fills all 64 bits of h0, so an index
+	// sum could overflow and the linear encoding has to fall back to coordinates
+	{
+		const uint d = 4;
+		using PosInt = uint16_t;
+		using hash = psh::morton_hash<d, PosInt, HashInt>;
+		using map = psh::map<d, uint, PosInt, HashInt, std::allocator<uint>, hash>;
+		using point = psh::point<d, PosInt>;
+
+		point u_bar{40000, 2, 2, 2};
+		uint u = psh::volume(u_bar);
+		std::vector<map::data_t> data;
+		for (uint i = 0; i < u; i++)
+		{
+			if (rand() % 10 == 0)
+				data.push_back(map::data_t{psh::index_to_point<d>(i, u_bar, u), i});
+		}
+		std::cout << "data size: " << data.size() << std::endl;
+
+		map s([&](size_t i) { return data[i]; }, data.size(), u_bar);
+		psh::packed_map<d, uint, PosInt, HashInt, hash> packed(s, psh::phi_encoding::linear);
+		if (packed.offset_encoding() != psh::phi_encoding::coordinates)
+			errors++;
+		errors += compare_packed(s, packed, u_bar);
+	}
+
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+// a domain with a different extent on every axis: every stored element has to come back
+// from get, every other point has to miss, in the map and in a packed copy of it
+void rectangular_test()
+{
+	const uint d = 3;
+	using PosInt = uint16_t;
+	using HashInt = uint8_t;
+	using map = psh::map<d, uint, PosInt, HashInt>;
+	using point = psh::point<d, PosInt>;
+
+	point u_bar{300, 40, 7};
+	uint u = psh::volume(u_bar);
+	std::vector<map::data_t> data;
+	std::vector<bool> data_b(u);
+	for (uint i = 0; i < u; i++)
+	{
+		if (rand() % 10 == 0)
+		{
+			data.push_back(map::data_t{psh::index_to_point<d>(i, u_bar, u), i});
+			data_b[i] = true;
+		}
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	map s([&](size_t i) { return data[i]; }, data.size(), u_bar);
+
+	uint errors = 0;
+	for (uint i = 0; i < u; i++)
+	{
+		auto p = psh::index_to_point<d>(i, u_bar, u);
+		uint contents;
+		bool stored = get_or_miss(s, p, contents);
+		if (psh::point_to_index(p, u_bar, u) != i || stored != data_b[i] || s.contains(p) != stored
+			|| (stored && contents != i))
+			errors++;
+	}
+	psh::packed_map<d, uint, PosInt, HashInt> packed(s);
+	errors += compare_packed(s, packed, u_bar);
+
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+// with a serial workspace that keeps its memory, rebuilding a map in place and applying
+// batches of updates to it, with a prefilter, mustn't allocate once everything has warmed up
+void allocation_test()
+{
+	const uint d = 3;
+	using PosInt = uint8_t;
+	using HashInt = uint16_t;
+	using map = psh::map<d, uint, PosInt, HashInt>;
+
+	PosInt width = 64;
+	uint u = width * width * width;
+	std::vector<map::data_t> data;
+	for (uint i = 0; i < u; i++)
+	{
+		if (rand() % 10 == 0)
+			data.push_back(map::data_t{psh::index_to_point<d>(i, width, uint(-1)), i});
+	}
+	// overwrites, new elements and some that will collide
+	std::vector<map::data_t> updates;
+	for (uint j = 0; j < 1000; j++)
+	{
+		uint i = rand() % u;
+		updates.push_back(map::data_t{psh::index_to_point<d>(i, width, uint(-1)), i});
+	}
+	std::cout << "data size: " << data.size() << std::endl;
+
+	// the largest map a round can rebuild into sizes the tables and the workspace
+	std::vector<map::data_t> all = data;
+	std::vector<bool> in_all(u, false);
+	for (auto& e : all)
+		in_all[psh::point_to_index<d>(e.location, width, uint(-1))] = true;
+	for (auto& e : updates)
+	{
+		auto i = psh::point_to_index<d>(e.location, width, uint(-1));
+		if (!in_all[i])
+			all.push_back(e);
+		in_all[i] = true;
+	}
+	map::workspace w(true, true);
+	map s([&](size_t i) { return all[i]; }, all.size(), psh::point<d, PosInt>::repeating(width), w, 0);
+	uint errors = 0;
+	for (auto kind : {psh::prefilter_kind::bitmap, psh::prefilter_kind::bloom})
+	{
+		s.use_prefilter(kind);
+		for (uint round = 0; round < 8; round++)
+		{
+			size_t before = allocations;
+			s.assign([&](size_t i) { return data[i]; }, data.size(), w);
+			auto summary = s.apply_updates([&](size_t i) { return updates[i]; }, updates.size(), w);
+			size_t count = allocations - before;
+			std::cout << "round " << round << ": " << count << " allocations" << std::endl;
+			// the first rounds size the workspace, the prefilter and the tables
+			// a rebuild that had to retry may grow the tables past anything they held before
+			if (round >= 3 && count != 0 && summary.rebuilt == 0)
+				errors++;
+		}
+		for (auto& e : updates)
+		{
+			if (s.get(e.location) != e.contents)
+				errors++;
+		}
+	}
+
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+// the data set of the generated static_map in static_map_example.inl: a 2D grid where
+// about a fifth of the points are stored, each with its own index as contents
+const uint static_map_width = 32;
+bool static_map_example_contains(uint i)
+{
+	return (i * 2654435761u) % 5 == 0;
+}
+
+// regenerates static_map_example.inl, run as: main --write-static-map-example static_map_example.inl
+// a fixed seed and a serial workspace give the same tables on every run
+void write_static_map_example(std::ostream& stream)
+{
+	const uint d = 2;
+	using map = psh::map<d, uint16_t, uint8_t, uint8_t>;
+	using static_map = psh::static_map<d, uint16_t, uint8_t, uint8_t>;
+
+	std::vector<map::data_t> data;
+	for (uint i = 0; i < static_map_width * static_map_width; i++)
+	{
+		if (static_map_example_contains(i))
+			data.push_back(map::data_t{psh::index_to_point<d>(i, uint8_t(static_map_width), uint(-1)),
+				uint16_t(i)});
+	}
+	map s([&](size_t i) { return data[i]; }, data.size(),
+		psh::point<d, uint8_t>::repeating(static_map_width),
+		map::workspace(false, true), 0);
+	static_map::write_source(stream, s, "static_map_example", "psh::static_map<2, uint16_t, uint8_t, uint8_t>");
+}
+
+#include "static_map_example.inl"
+
+// looks up every point of the domain in the tables that write_static_map_example generated
+void static_map_test()
+{
+	const uint d = 2;
+	using point = psh::point<d, uint8_t>;
+	static_assert(std::is_same<decltype(static_map_example),
+		const psh::static_map<2, uint16_t, uint8_t, uint8_t>>::value, "wrong static_map type");
+
+	uint errors = 0;
+	uint stored = 0;
+	for (uint i = 0; i < static_map_width * static_map_width; i++)
+	{
+		point p = psh::index_to_point<d>(i, uint8_t(static_map_width), uint(-1));
+		auto contents = static_map_example.find(p);
+		if ((contents != nullptr) != static_map_example_contains(i)
+			|| (contents != nullptr && *contents != i))
+			errors++;
+		stored += static_map_example_contains(i);
+	}
+	if (static_map_example.size() != stored)
+		errors++;
+
+	std::cout << "data size: " << stored << std::endl;
+	std::cout << errors << " errors" << std::endl;
+	std::cout << "finished!" << std::endl;
+}
+
+int main( int argc, const char* argv[] )
+{
+	if (argc == 3 && std::string(argv[1]) == "--write-static-map-example")
+	{
+		std::ofstream stream(argv[2]);
+		write_static_map_example(stream);
+		return 0;
+	}
 	game_of_life_test();
 }
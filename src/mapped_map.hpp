@@ -0,0 +1,679 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_sort.h"
+#include "psh.hpp"
+
+namespace psh
+{
+	// a file mapped into memory, read-only or for writing
+	class mapped_file
+	{
+		void* address;
+		size_t length;
+
+	public:
+		mapped_file() : address(nullptr), length(0) { }
+
+		// maps an existing file
+		explicit mapped_file(const std::string& path) : mapped_file()
+		{
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				throw std::runtime_error("Can't open " + path);
+			struct stat info;
+			if (fstat(fd, &info) != 0)
+			{
+				::close(fd);
+				throw std::runtime_error("Can't read the size of " + path);
+			}
+			map(fd, info.st_size, PROT_READ, path);
+		}
+
+		// creates (or truncates) a file of the given size, and maps it for writing
+		mapped_file(const std::string& path, size_t size) : mapped_file()
+		{
+			int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0)
+				throw std::runtime_error("Can't create " + path);
+			if (ftruncate(fd, size) != 0)
+			{
+				::close(fd);
+				throw std::runtime_error("Can't resize " + path);
+			}
+			map(fd, size, PROT_READ | PROT_WRITE, path);
+		}
+
+		mapped_file(mapped_file&& other) : address(other.address), length(other.length)
+		{
+			other.address = nullptr;
+			other.length = 0;
+		}
+		mapped_file& operator=(mapped_file&& other)
+		{
+			std::swap(address, other.address);
+			std::swap(length, other.length);
+			return *this;
+		}
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		~mapped_file()
+		{
+			if (address != nullptr)
+				munmap(address, length);
+		}
+
+		char* data() const
+		{
+			return static_cast<char*>(address);
+		}
+		size_t size() const
+		{
+			return length;
+		}
+
+	private:
+		void map(int fd, size_t size, int protection, const std::string& path)
+		{
+			address = size == 0 ? nullptr : mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (address == MAP_FAILED)
+			{
+				address = nullptr;
+				throw std::runtime_error("Can't map " + path);
+			}
+			length = size;
+		}
+	};
+
+	// a read-only map stored in a file, which is mapped into memory instead of loaded,
+	// so only the pages that lookups touch are ever read from disk
+	// build creates the file without holding the data set or the tables in memory:
+	// - the input is streamed once into runs on disk, partitioned by bucket
+	// - each partition is sorted by bucket and its buckets are appended to one run per size
+	//   class (powers of two), so the buckets can be placed roughly largest first while
+	//   reading every run once, a chunk at a time
+	// - phi, H and the element locations are written straight into the mapped output file
+	// - the positional hashes are fixed with sweeps over the domain, instead of collecting
+	//   the colliding points, until no point outside the map shares a stored element's hash
+	// the resident memory is the chunk budget, plus two bits per slot of the hash table,
+	// plus whichever pages of the output the OS chooses to keep
+	// T must be trivially copyable, since it's written to disk as it is
+	template<uint d, class T, class PosInt, class HashInt, class Hash>
+	class mapped_map
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+		static_assert(std::is_trivially_copyable<Hash>::value, "Hash must be trivially copyable");
+		using IndexInt = size_t;
+		using source = map<d, T, PosInt, HashInt, std::allocator<T>, Hash>;
+		static constexpr uint64_t file_version = 1;
+		// the number of size classes, the last one holds every bucket of 2^(classes - 1) or more
+		static constexpr uint num_classes = 8;
+
+	public:
+		struct data_t
+		{
+			point<d, PosInt> location;
+			T contents;
+		};
+		struct entry
+		{
+			T contents;
+			HashInt k;
+			HashInt hk;
+		};
+		// calls the sink with every element of the data set, it's called again for every
+		// offset table size that has to be tried
+		using data_source = std::function<void(const std::function<void(const data_t&)>&)>;
+
+		struct build_options
+		{
+			// at most this many bytes of input are held in memory at once
+			IndexInt memory_budget = IndexInt(256) << 20;
+			// the runs are stored next to the output, with this appended to its path
+			std::string run_suffix = ".run";
+			typename source::seed_type seed = typename source::seed_type(time(0));
+		};
+
+	private:
+		struct header
+		{
+			char magic[8];
+			uint64_t version;
+			uint64_t dimensions;
+			uint64_t contents_size;
+			uint64_t hash_size;
+			uint64_t n;
+			uint64_t m;
+			uint64_t r;
+			point<d, PosInt> m_bar;
+			PosInt r_bar;
+			Hash hash;
+		};
+
+		// where each table starts in the file
+		struct layout
+		{
+			IndexInt phi;
+			IndexInt H;
+			IndexInt locations;
+			IndexInt occupancy;
+			IndexInt size;
+
+			layout(IndexInt m, IndexInt r)
+			{
+				phi = align(sizeof(header));
+				H = align(phi + sizeof(point<d, PosInt>) * r);
+				locations = align(H + sizeof(entry) * m);
+				occupancy = align(locations + sizeof(point<d, PosInt>) * m);
+				size = occupancy + sizeof(uint64_t) * ((m + 63) / 64);
+			}
+
+			static IndexInt align(IndexInt offset)
+			{
+				return (offset + 63) / 64 * 64;
+			}
+		};
+
+		// an element on its way through the runs
+		struct record
+		{
+			IndexInt bucket;
+			data_t data;
+		};
+
+		mapped_file file;
+		const header* info;
+		const point<d, PosInt>* phi;
+		const entry* H;
+		const point<d, PosInt>* locations;
+		const uint64_t* occupancy;
+
+	public:
+		// maps a file created by build
+		explicit mapped_map(const std::string& path) : file(path)
+		{
+			info = reinterpret_cast<const header*>(file.data());
+			if (file.size() < sizeof(header) || std::memcmp(info->magic, "psh-map", 8) != 0
+				|| info->version != file_version || info->dimensions != d
+				|| info->contents_size != sizeof(T) || info->hash_size != sizeof(Hash))
+				throw std::runtime_error(path + " isn't a map of this type");
+			layout l(info->m, info->r);
+			if (file.size() < l.size)
+				throw std::runtime_error(path + " is truncated");
+			phi = reinterpret_cast<const point<d, PosInt>*>(file.data() + l.phi);
+			H = reinterpret_cast<const entry*>(file.data() + l.H);
+			locations = reinterpret_cast<const point<d, PosInt>*>(file.data() + l.locations);
+			occupancy = reinterpret_cast<const uint64_t*>(file.data() + l.occupancy);
+		}
+
+		// the contents stored at p, or nullptr if p isn't in the map
+		const T* find(const point<d, PosInt>& p) const
+		{
+			auto i = slot(info->hash, info->m_bar, info->m, info->r_bar, info->r, phi, p);
+			if (!occupied(occupancy, i) || H[i].hk != info->hash.hk(p, H[i].k))
+				return nullptr;
+			return &H[i].contents;
+		}
+
+		const T& get(const point<d, PosInt>& p) const
+		{
+			auto output = find(p);
+			if (output == nullptr)
+				throw std::out_of_range("Element not found in map");
+			return *output;
+		}
+
+		bool contains(const point<d, PosInt>& p) const
+		{
+			return find(p) != nullptr;
+		}
+
+		// calls f(location, contents) for every stored element
+		template<class F>
+		void for_each(F f) const
+		{
+			for (IndexInt i = 0; i < info->m; i++)
+			{
+				if (occupied(occupancy, i))
+					f(locations[i], H[i].contents);
+			}
+		}
+
+		IndexInt size() const
+		{
+			return info->n;
+		}
+
+		// the size of the file, most of which is usually not resident
+		size_t file_size() const
+		{
+			return file.size();
+		}
+
+		// builds a map of the n elements from data into a file at path
+		// throws std::invalid_argument if two of the elements share a location
+		static void build(const std::string& path, const data_source& data, IndexInt n,
+			const point<d, PosInt>& u_bar, const build_options& options = build_options())
+		{
+			auto m_bar = source::table_shape(n, u_bar);
+			IndexInt m = volume(m_bar);
+			PosInt r_bar = source::initial_r_bar(n);
+			std::default_random_engine generator(options.seed);
+			Hash hash;
+			hash.pick(generator);
+			VALUE(m);
+			VALUE(m_bar);
+			VALUE(hash);
+
+			while (true)
+			{
+				// if we fail, we try again with a larger offset table
+				r_bar += d;
+				IndexInt r = std::pow(r_bar, d);
+				VALUE(r);
+				VALUE(uint(r_bar));
+				if (source::bad_m_r(m_bar, r_bar))
+					continue;
+
+				layout l(m, r);
+				mapped_file output(path, l.size);
+				auto out_phi = reinterpret_cast<point<d, PosInt>*>(output.data() + l.phi);
+				auto out_H = reinterpret_cast<entry*>(output.data() + l.H);
+				auto out_locations = reinterpret_cast<point<d, PosInt>*>(output.data() + l.locations);
+				std::vector<uint64_t> out_occupancy((m + 63) / 64, 0);
+
+				partition(path, data, n, r_bar, r, hash, options);
+				bool success;
+				try
+				{
+					success = place(path, m_bar, m, r, hash, options, generator,
+						out_phi, out_H, out_locations, out_occupancy);
+				}
+				catch (...)
+				{
+					remove_runs(path, options);
+					throw;
+				}
+				remove_runs(path, options);
+				if (!success)
+					continue;
+				if (!hash_positions(m_bar, m, r_bar, r, hash, u_bar,
+					out_phi, out_H, out_locations, out_occupancy))
+					continue;
+
+				std::copy(out_occupancy.begin(), out_occupancy.end(),
+					reinterpret_cast<uint64_t*>(output.data() + l.occupancy));
+				header h = header();
+				std::memcpy(h.magic, "psh-map", 8);
+				h.version = file_version;
+				h.dimensions = d;
+				h.contents_size = sizeof(T);
+				h.hash_size = sizeof(Hash);
+				h.n = n;
+				h.m = m;
+				h.r = r;
+				h.m_bar = m_bar;
+				h.r_bar = r_bar;
+				h.hash = hash;
+				std::memcpy(output.data(), &h, sizeof(h));
+				if (msync(output.data(), output.size(), MS_SYNC) != 0)
+					throw std::runtime_error("Can't write " + path);
+				return;
+			}
+		}
+
+	private:
+		static IndexInt slot(const Hash& hash, const point<d, PosInt>& m_bar, IndexInt m,
+			PosInt r_bar, IndexInt r, const point<d, PosInt>* phi, const point<d, PosInt>& p)
+		{
+			auto offset = phi[point_to_index(hash.h1(p), r_bar, r)];
+			return point_to_index(hash.h0(p) + point<d, IndexInt>(offset), m_bar, m);
+		}
+
+		static bool occupied(const uint64_t* bits, IndexInt i)
+		{
+			return (bits[i / 64] >> (i % 64)) & 1;
+		}
+
+		static std::string run_path(const std::string& path, const build_options& options,
+			const char* kind, IndexInt i)
+		{
+			return path + options.run_suffix + "." + kind + std::to_string(i);
+		}
+
+		static std::FILE* open_run(const std::string& path, const char* mode)
+		{
+			auto output = std::fopen(path.c_str(), mode);
+			if (output == nullptr)
+				throw std::runtime_error("Can't open " + path);
+			return output;
+		}
+
+		// the number of partitions so that one fits in the memory budget
+		static IndexInt num_partitions(IndexInt n, const build_options& options)
+		{
+			return std::max(IndexInt(1), (n * sizeof(record) + options.memory_budget - 1)
+				/ options.memory_budget);
+		}
+
+		static void remove_runs(const std::string& path, const build_options& options)
+		{
+			for (uint c = 0; c < num_classes; c++)
+			{
+				std::remove(run_path(path, options, "class", c).c_str());
+			}
+		}
+
+		// streams the input into partitions by bucket, then splits every partition
+		// into the size class runs, with the elements of a bucket next to each other
+		static void partition(const std::string& path, const data_source& data, IndexInt n,
+			PosInt r_bar, IndexInt r, const Hash& hash, const build_options& options)
+		{
+			auto partitions = num_partitions(n, options);
+			std::vector<std::FILE*> runs;
+			for (IndexInt i = 0; i < partitions; i++)
+			{
+				runs.push_back(open_run(run_path(path, options, "partition", i), "wb"));
+			}
+			data([&](const data_t& element)
+				{
+					auto bucket = point_to_index(hash.h1(element.location), r_bar, r);
+					record output{bucket, element};
+					std::fwrite(&output, sizeof(output), 1, runs[bucket * partitions / r]);
+				});
+			for (auto run : runs)
+			{
+				std::fclose(run);
+			}
+
+			std::vector<std::FILE*> classes;
+			for (uint c = 0; c < num_classes; c++)
+			{
+				classes.push_back(open_run(run_path(path, options, "class", c), "wb"));
+			}
+			std::vector<record> records;
+			for (IndexInt i = 0; i < partitions; i++)
+			{
+				auto partition_path = run_path(path, options, "partition", i);
+				read_run(partition_path, records);
+				std::remove(partition_path.c_str());
+				tbb::parallel_sort(records.begin(), records.end(),
+					[](const record& lhs, const record& rhs)
+					{
+						return lhs.bucket < rhs.bucket;
+					});
+				for (IndexInt first = 0; first < records.size(); )
+				{
+					auto last = bucket_end(records, first);
+					uint c = 0;
+					while (c + 1 < num_classes && (IndexInt(2) << c) <= last - first)
+					{
+						c++;
+					}
+					std::fwrite(records.data() + first, sizeof(record), last - first, classes[c]);
+					first = last;
+				}
+			}
+			for (auto run : classes)
+			{
+				std::fclose(run);
+			}
+		}
+
+		static void read_run(const std::string& path, std::vector<record>& records)
+		{
+			auto run = open_run(path, "rb");
+			std::fseek(run, 0, SEEK_END);
+			records.resize(std::ftell(run) / sizeof(record));
+			std::fseek(run, 0, SEEK_SET);
+			auto count = std::fread(records.data(), sizeof(record), records.size(), run);
+			std::fclose(run);
+			if (count != records.size())
+				throw std::runtime_error("Can't read " + path);
+		}
+
+		// the end of the bucket that starts at first
+		static IndexInt bucket_end(const std::vector<record>& records, IndexInt first)
+		{
+			auto last = first + 1;
+			while (last < records.size() && records[last].bucket == records[first].bucket)
+			{
+				last++;
+			}
+			return last;
+		}
+
+		// places every bucket, reading the size class runs from the largest buckets down,
+		// a chunk of at most the memory budget at a time
+		static bool place(const std::string& path, const point<d, PosInt>& m_bar, IndexInt m,
+			IndexInt r, const Hash& hash, const build_options& options,
+			std::default_random_engine& generator, point<d, PosInt>* phi, entry* H,
+			point<d, PosInt>* locations, std::vector<uint64_t>& occupancy)
+		{
+			std::uniform_int_distribution<IndexInt> m_dist(0, m - 1);
+			const IndexInt chunk_size = std::max(IndexInt(1), options.memory_budget / sizeof(record));
+			std::vector<record> records;
+			// (size, start) of every bucket in the chunk
+			std::vector<std::pair<IndexInt, IndexInt>> buckets;
+			std::vector<IndexInt> slots;
+
+			for (uint c = num_classes; c-- > 0;)
+			{
+				auto run = open_run(run_path(path, options, "class", c), "rb");
+				records.clear();
+				bool done = false;
+				while (!done)
+				{
+					// top up the chunk, which might start with a bucket left over from the last one
+					auto kept = records.size();
+					records.resize(std::max(chunk_size, kept + 1));
+					kept += std::fread(records.data() + kept, sizeof(record), records.size() - kept, run);
+					done = kept < records.size();
+					records.resize(kept);
+
+					// the last bucket might continue in the next chunk
+					IndexInt end = records.size();
+					if (!done)
+					{
+						while (end > 0 && records[end - 1].bucket == records.back().bucket)
+						{
+							end--;
+						}
+						// a single bucket that's larger than the chunk has to grow it
+						if (end == 0)
+							continue;
+					}
+
+					buckets.clear();
+					for (IndexInt first = 0; first < end; )
+					{
+						auto last = bucket_end(records, first);
+						buckets.emplace_back(last - first, first);
+						first = last;
+					}
+					std::sort(buckets.begin(), buckets.end(),
+						[](const std::pair<IndexInt, IndexInt>& lhs, const std::pair<IndexInt, IndexInt>& rhs)
+						{
+							return lhs.first > rhs.first;
+						});
+					for (auto& b : buckets)
+					{
+						if (!place_bucket(records.data() + b.second, b.first, m_bar, m, r, hash,
+							m_dist(generator), slots, phi, H, locations, occupancy))
+						{
+							std::fclose(run);
+							return false;
+						}
+					}
+					records.erase(records.begin(), records.begin() + end);
+				}
+				std::fclose(run);
+			}
+			return true;
+		}
+
+		// finds an offset that maps every element of the bucket to a free slot, and stores them
+		// two elements at the same location are always in the same bucket and collide there
+		static bool place_bucket(const record* elements, IndexInt size, const point<d, PosInt>& m_bar,
+			IndexInt m, IndexInt r, const Hash& hash, IndexInt start_offset,
+			std::vector<IndexInt>& slots, point<d, PosInt>* phi, entry* H,
+			point<d, PosInt>* locations, std::vector<uint64_t>& occupancy)
+		{
+			// all elements in a bucket share the same offset, so if two of them collide
+			// without an offset they will collide with every offset
+			slots.clear();
+			for (IndexInt j = 0; j < size; j++)
+			{
+				slots.push_back(point_to_index(hash.h0(elements[j].data.location), m_bar, m));
+			}
+			std::sort(slots.begin(), slots.end());
+			if (std::adjacent_find(slots.begin(), slots.end()) != slots.end())
+			{
+				// retrying with another offset table would never get rid of a duplicate
+				for (IndexInt j = 0; j < size; j++)
+				{
+					for (IndexInt k = j + 1; k < size; k++)
+					{
+						if (elements[j].data.location == elements[k].data.location)
+							throw std::invalid_argument("Two elements share a location");
+					}
+				}
+				return false;
+			}
+
+			for (IndexInt i = 0; i < r; i++)
+			{
+				// wrap around m to stay inside the table
+				auto offset = index_to_point<d>((start_offset + i) % m, m_bar, m);
+				slots.clear();
+				for (IndexInt j = 0; j < size; j++)
+				{
+					auto slot = point_to_index(hash.h0(elements[j].data.location)
+						+ point<d, IndexInt>(offset), m_bar, m);
+					if (occupied(occupancy.data(), slot))
+						break;
+					slots.push_back(slot);
+				}
+				if (slots.size() < size)
+					continue;
+
+				phi[elements[0].bucket] = offset;
+				for (IndexInt j = 0; j < size; j++)
+				{
+					auto& data = elements[j].data;
+					H[slots[j]] = entry{data.contents, 1, hash.hk(data.location, 1)};
+					locations[slots[j]] = data.location;
+					occupancy[slots[j] / 64] |= uint64_t(1) << (slots[j] % 64);
+				}
+				return true;
+			}
+			return false;
+		}
+
+		// the first sweep over the domain finds the slots where a point outside the map has
+		// the same positional hash as the stored element, then every further sweep tries the
+		// next 64 values of k for all of those slots at once, and each slot keeps the first k
+		// that no point shares, so no list of colliding points is ever held in memory
+		static bool hash_positions(const point<d, PosInt>& m_bar, IndexInt m, PosInt r_bar,
+			IndexInt r, const Hash& hash, const point<d, PosInt>& u_bar, const point<d, PosInt>* phi,
+			entry* H, const point<d, PosInt>* locations, const std::vector<uint64_t>& occupancy)
+		{
+			auto u = volume(u_bar);
+			// calls f(p, l) for every point p outside the map, where l is its slot
+			auto sweep = [&](const std::function<void(const point<d, PosInt>&, IndexInt)>& f)
+				{
+					tbb::parallel_for(tbb::blocked_range<IndexInt>(0, u),
+						[&](const tbb::blocked_range<IndexInt>& range)
+						{
+							for (IndexInt i = range.begin(); i != range.end(); i++)
+							{
+								auto p = index_to_point<d, PosInt>(i, u_bar, u);
+								auto l = slot(hash, m_bar, m, r_bar, r, phi, p);
+								if (occupied(occupancy.data(), l) && locations[l] != p)
+									f(p, l);
+							}
+						});
+				};
+
+			std::vector<uint64_t> conflicts(occupancy.size(), 0);
+			sweep([&](const point<d, PosInt>& p, IndexInt l)
+				{
+					if (H[l].hk == hash.hk(p, H[l].k))
+						atomic_or(conflicts[l / 64], uint64_t(1) << (l % 64));
+				});
+
+			const IndexInt max_k = std::numeric_limits<HashInt>::max();
+			std::vector<IndexInt> ranks(conflicts.size());
+			std::vector<uint64_t> bad;
+			for (IndexInt k0 = 2; ; k0 += 64)
+			{
+				// the index of every conflicting slot among them
+				IndexInt count = 0;
+				for (IndexInt w = 0; w < conflicts.size(); w++)
+				{
+					ranks[w] = count;
+					count += count_bits(conflicts[w]);
+				}
+				if (count == 0)
+					return true;
+				if (k0 > max_k)
+					return false;
+
+				// bit j is set if k0 + j doesn't work for that slot
+				bad.assign(count, 0);
+				uint64_t out_of_range = 0;
+				for (IndexInt j = 0; j < 64; j++)
+				{
+					if (k0 + j > max_k)
+						out_of_range |= uint64_t(1) << j;
+				}
+				sweep([&](const point<d, PosInt>& p, IndexInt l)
+					{
+						auto w = l / 64;
+						auto bit = uint64_t(1) << (l % 64);
+						if (!(conflicts[w] & bit))
+							return;
+						uint64_t mask = 0;
+						for (IndexInt j = 0; j < 64 && k0 + j <= max_k; j++)
+						{
+							HashInt k = HashInt(k0 + j);
+							if (hash.hk(p, k) == hash.hk(locations[l], k))
+								mask |= uint64_t(1) << j;
+						}
+						if (mask != 0)
+							atomic_or(bad[ranks[w] + count_bits(conflicts[w] & (bit - 1))], mask);
+					});
+
+				IndexInt j = 0;
+				for (IndexInt l = 0; l < m; l++)
+				{
+					if (!occupied(conflicts.data(), l))
+						continue;
+					auto good = ~(bad[j++] | out_of_range);
+					if (good == 0)
+						continue;
+					H[l].k = HashInt(k0 + count_trailing_zeros(good));
+					H[l].hk = hash.hk(locations[l], H[l].k);
+					conflicts[l / 64] &= ~(uint64_t(1) << (l % 64));
+				}
+			}
+		}
+	};
+}
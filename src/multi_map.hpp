@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_sort.h"
+#include "psh.hpp"
+
+namespace psh
+{
+	// a perfect spatial hash where every point has any number of values, e.g. particles per cell
+	// the values of all points are stored back to back in one pool, in the order they were given,
+	// and the hash table only stores (offset, length) into the pool for each point,
+	// so entries stay small and cheap to move around while the map is built
+	// d is the dimensionality, V is the value type
+	// PosInt and HashInt are passed on to the map
+	template<uint d, class V, class PosInt, class HashInt>
+	class multi_map
+	{
+		using IndexInt = size_t;
+
+	public:
+		// where the values of a point are in the pool
+		struct range
+		{
+			uint32_t offset;
+			uint32_t length;
+		};
+		using map = psh::map<d, range, PosInt, HashInt>;
+
+		struct value_t
+		{
+			point<d, PosInt> location;
+			V value;
+		};
+		using data_function = std::function<value_t(IndexInt)>;
+
+		// the values of a point, valid as long as the multi_map is
+		class values
+		{
+			const V* first;
+			IndexInt count;
+
+		public:
+			values() : first(nullptr), count(0) { }
+			values(const V* first, IndexInt count) : first(first), count(count) { }
+
+			const V* begin() const
+			{
+				return first;
+			}
+			const V* end() const
+			{
+				return first + count;
+			}
+			const V* data() const
+			{
+				return first;
+			}
+			IndexInt size() const
+			{
+				return count;
+			}
+			bool empty() const
+			{
+				return count == 0;
+			}
+			const V& operator[](IndexInt i) const
+			{
+				return first[i];
+			}
+		};
+
+	private:
+		std::vector<V> pool;
+		map s;
+
+	public:
+		// data maps an index to a (location, value) pair, n is the total number of values,
+		// a location can appear any number of times
+		// u_bar is the limit of the domain in each dimension
+		multi_map(const data_function& data, IndexInt n, const point<d, PosInt>& u_bar)
+			: s(build(data, n, u_bar, pool))
+		{
+		}
+		multi_map(const data_function& data, IndexInt n, PosInt u_bar)
+			: multi_map(data, n, point<d, PosInt>::repeating(u_bar)) { }
+
+		// the values stored at p, throws if p isn't in the map
+		values get(const point<d, PosInt>& p) const
+		{
+			auto& r = s.get(p);
+			return values(pool.data() + r.offset, r.length);
+		}
+
+		// the values stored at p, or none if p isn't in the map
+		values find(const point<d, PosInt>& p) const
+		{
+			auto r = s.find(p);
+			if (r == nullptr)
+				return values();
+			return values(pool.data() + r->offset, r->length);
+		}
+
+		bool contains(const point<d, PosInt>& p) const
+		{
+			return s.contains(p);
+		}
+
+		// calls f(location, values) for every stored point
+		template<class F>
+		void for_each(F f) const
+		{
+			for (auto e : s)
+			{
+				f(e.location, values(pool.data() + e.contents.offset, e.contents.length));
+			}
+		}
+
+		// number of distinct points
+		IndexInt size() const
+		{
+			return s.size();
+		}
+
+		// number of values, over all points
+		IndexInt num_values() const
+		{
+			return pool.size();
+		}
+
+		const map& ranges() const
+		{
+			return s;
+		}
+
+		size_t memory_size() const
+		{
+			return sizeof(*this) - sizeof(s) + s.memory_size() + sizeof(V) * pool.capacity();
+		}
+
+	private:
+		// fills the pool, grouped by point, and builds the map of ranges into it
+		static map build(const data_function& data, IndexInt n, const point<d, PosInt>& u_bar,
+			std::vector<V>& pool)
+		{
+			if (n > std::numeric_limits<uint32_t>::max())
+				throw std::length_error("Too many values for a multi_map");
+			auto u = volume(u_bar);
+
+			// data is called serially, like map does, so it doesn't have to be thread-safe
+			std::vector<value_t> items;
+			items.reserve(n);
+			for (IndexInt i = 0; i < n; i++)
+			{
+				items.push_back(data(i));
+			}
+			// (index of the location in the domain, index of the value), sorting it groups the
+			// values by location and keeps the values of a location in their original order
+			std::vector<std::pair<IndexInt, IndexInt>> order(n);
+			tbb::parallel_for(IndexInt(0), n, [&](IndexInt i)
+				{
+					order[i] = std::make_pair(point_to_index(items[i].location, u_bar, u), i);
+				});
+			tbb::parallel_sort(order.begin(), order.end());
+
+			pool.resize(n);
+			tbb::parallel_for(IndexInt(0), n, [&](IndexInt i)
+				{
+					pool[i] = std::move(items[order[i].second].value);
+				});
+
+			std::vector<typename map::data_t> ranges;
+			for (IndexInt i = 0; i < n; )
+			{
+				IndexInt j = i + 1;
+				while (j < n && order[j].first == order[i].first)
+				{
+					j++;
+				}
+				ranges.push_back(typename map::data_t{items[order[i].second].location,
+					range{uint32_t(i), uint32_t(j - i)}});
+				i = j;
+			}
+			items.clear();
+			items.shrink_to_fit();
+			order.clear();
+			order.shrink_to_fit();
+
+			return map([&](IndexInt i) { return ranges[i]; }, ranges.size(), u_bar);
+		}
+	};
+}
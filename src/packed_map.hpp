@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "psh.hpp"
+#include "bit_array.hpp"
+
+namespace psh
+{
+	// describes how to store T in as few bits as possible in a packed_map
+	// specialize this for small enums and other types with only a few possible values
+	template<class T>
+	struct packed_traits
+	{
+		// types that can't be packed are stored unpacked next to the packed table
+		static constexpr bool packable = std::is_trivially_copyable<T>::value
+			&& sizeof(T) <= sizeof(uint64_t);
+		static constexpr uint bits = packable ? sizeof(T) * 8 : 0;
+
+		static uint64_t encode(const T& value)
+		{
+			uint64_t output = 0;
+			std::memcpy(&output, &value, packable ? sizeof(T) : 0);
+			return output;
+		}
+		static T decode(uint64_t value)
+		{
+			T output = T();
+			std::memcpy(&output, &value, packable ? sizeof(T) : 0);
+			return output;
+		}
+	};
+
+	template<>
+	struct packed_traits<bool>
+	{
+		static constexpr bool packable = true;
+		static constexpr uint bits = 1;
+
+		static uint64_t encode(bool value) { return value; }
+		static bool decode(uint64_t value) { return value != 0; }
+	};
+
+	// how the offset table is stored in a packed_map
+	enum class phi_encoding
+	{
+		// each offset as d packed coordinates, each as wide as the hash table in that dimension
+		coordinates,
+		// each offset as a single index into the hash table, which is then added to h0's index
+		linear
+	};
+
+	// a read-only, bit-packed copy of a finished map
+	// every entry in the hash table is stored as (k - 1, hk, contents) in as few bits as possible,
+	// where the width of k is chosen from the largest k the map needed
+	// the offset table is packed as well, see phi_encoding
+	template<uint d, class T, class PosInt, class HashInt, class Hash>
+	class packed_map
+	{
+		static_assert(sizeof(HashInt) < sizeof(uint64_t), "HashInt must be smaller than 64 bits");
+		using IndexInt = size_t;
+		using traits = packed_traits<T>;
+
+		Hash hash;
+		point<d, PosInt> m_bar;
+		IndexInt m;
+		PosInt r_bar;
+		IndexInt r;
+		phi_encoding encoding;
+		// width of each coordinate in an offset, only used for phi_encoding::coordinates
+		point<d, uint> phi_bits;
+		bit_array phi;
+		// width of each field in an entry
+		uint k_bits;
+		uint hk_bits;
+		uint contents_bits;
+		// whether the contents fit in the same record as k and hk
+		bool contents_inline;
+		bit_array H;
+		// only used if the contents aren't inline
+		std::vector<T> contents;
+
+	public:
+		// linear encoding falls back to coordinates if the index sum could overflow
+		template<class Allocator>
+		packed_map(const map<d, T, PosInt, HashInt, Allocator, Hash>& s,
+			phi_encoding encoding = phi_encoding::linear)
+			: hash(s.hash), m_bar(s.m_bar), m(s.m), r_bar(s.r_bar), r(s.r),
+			  encoding(encoding), hk_bits(sizeof(HashInt) * 8)
+		{
+			if (!s.positional_hashes)
+				throw std::invalid_argument("The map was built without positional hashes");
+			if (encoding == phi_encoding::linear && !linear_is_exact(s.u_bar))
+				this->encoding = phi_encoding::coordinates;
+			pack_phi(s.phi);
+
+			HashInt max_k = 1;
+			for (auto& e : s.H)
+			{
+				max_k = std::max(max_k, e.k);
+			}
+			// k is always at least 1, so store k - 1 to save a bit (or all of them)
+			k_bits = bits_needed(max_k - 1);
+			contents_inline = traits::packable && k_bits + hk_bits + traits::bits <= 64;
+			contents_bits = contents_inline ? traits::bits : 0;
+
+			H = bit_array(m, k_bits + hk_bits + contents_bits);
+			if (!contents_inline)
+				contents.reserve(m);
+			for (IndexInt i = 0; i < m; i++)
+			{
+				auto& e = s.H[i];
+				uint64_t record = uint64_t(e.k - 1) | uint64_t(e.hk) << k_bits;
+				if (contents_inline)
+					record |= traits::encode(e.contents) << (k_bits + hk_bits);
+				else
+					contents.push_back(e.contents);
+				H.set(i, record);
+			}
+		}
+
+		T get(const point<d, PosInt>& p) const
+		{
+			auto h0 = hash.h0(p);
+			auto h1 = hash.h1(p);
+			auto offset = phi.get(point_to_index(h1, r_bar, r));
+			IndexInt i;
+			if (encoding == phi_encoding::linear)
+				i = (point_to_index(h0, m_bar, m) + offset) % m;
+			else
+				i = point_to_index(h0 + unpack_offset(offset), m_bar, m);
+
+			uint64_t record = H.get(i);
+			HashInt k = HashInt(record & mask(k_bits)) + 1;
+			HashInt hk = HashInt((record >> k_bits) & mask(hk_bits));
+			if (hk != hash.hk(p, k))
+				throw std::out_of_range("Element not found in map");
+
+			if (contents_inline)
+				return traits::decode((record >> (k_bits + hk_bits)) & mask(contents_bits));
+			return contents[i];
+		}
+
+		phi_encoding offset_encoding() const
+		{
+			return encoding;
+		}
+
+		// the number of bits used for each slot in the offset table
+		uint offset_bits() const
+		{
+			return phi.field_width();
+		}
+
+		// the number of bits used for each entry in the hash table
+		uint entry_bits() const
+		{
+			return H.field_width() + (contents_inline ? 0 : sizeof(T) * 8);
+		}
+
+		size_t memory_size() const
+		{
+			return sizeof(*this)
+				+ phi.memory_size() - sizeof(phi)
+				+ H.memory_size() - sizeof(H)
+				+ sizeof(T) * contents.capacity();
+		}
+
+	private:
+		static constexpr uint64_t mask(uint bits)
+		{
+			return bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+		}
+
+		// the index of a sum of points is the sum of their indices, modulo m,
+		// as long as computing the index of h0 + offset doesn't overflow
+		bool linear_is_exact(const point<d, PosInt>& u_bar) const
+		{
+			long double max_index = 0;
+			auto h0_limit = hash.h0_limit(u_bar);
+			for (uint i = 0; i < d; i++)
+			{
+				long double stride = 1;
+				for (uint j = i + 1; j < d; j++)
+				{
+					stride *= m_bar[j];
+				}
+				max_index += ((long double)(h0_limit[i]) + m_bar[i]) * stride;
+			}
+			return max_index < std::pow(2.0L, 64);
+		}
+
+		template<class Phi>
+		void pack_phi(const Phi& source_phi)
+		{
+			if (encoding == phi_encoding::linear)
+			{
+				phi = bit_array(r, bits_needed(m - 1));
+				for (IndexInt i = 0; i < r; i++)
+				{
+					phi.set(i, point_to_index(source_phi[i], m_bar, m));
+				}
+				return;
+			}
+
+			uint total_bits = 0;
+			for (uint j = 0; j < d; j++)
+			{
+				phi_bits[j] = bits_needed(m_bar[j] - 1);
+				total_bits += phi_bits[j];
+			}
+			phi = bit_array(r, total_bits);
+			for (IndexInt i = 0; i < r; i++)
+			{
+				uint64_t packed = 0;
+				uint shift = 0;
+				for (uint j = 0; j < d; j++)
+				{
+					packed |= uint64_t(source_phi[i][j]) << shift;
+					shift += phi_bits[j];
+				}
+				phi.set(i, packed);
+			}
+		}
+
+		point<d, IndexInt> unpack_offset(uint64_t packed) const
+		{
+			point<d, IndexInt> output;
+			for (uint j = 0; j < d; j++)
+			{
+				output[j] = packed & mask(phi_bits[j]);
+				packed >>= phi_bits[j];
+			}
+			return output;
+		}
+	};
+}
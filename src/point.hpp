@@ -138,14 +138,13 @@ namespace std
 	{
 		size_t operator()(const psh::point<d, Scalar>& p) const
 		{
-			// Compute individual hash values for first,
-			// second and third and combine them using XOR
-			// and bit shifting:
-
+			// combines the hashes of the coordinates like boost::hash_combine, since a plain XOR
+			// sends every point with the same XOR of its coordinates, e.g. all of (x, x, z),
+			// to the same bucket, and hash<Scalar> is usually the identity for integers
 			size_t output = hash<Scalar>()(p[0]);
 			for (uint i = 1; i < d; i++)
 			{
-				output ^= hash<Scalar>()(p[i]);
+				output ^= hash<Scalar>()(p[i]) + size_t(0x9e3779b97f4a7c15ull) + (output << 6) + (output >> 2);
 			}
 			return output;
 		}
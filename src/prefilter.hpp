@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "point.hpp"
+#include "util.hpp"
+
+namespace psh
+{
+	enum class prefilter_kind
+	{
+		none,
+		// one bit per point in the domain
+		bitmap,
+		// a blocked Bloom filter, about 10 bits per stored element
+		bloom,
+		// a bitmap if the domain is small enough that it's not larger than a Bloom filter,
+		// otherwise a Bloom filter
+		automatic
+	};
+
+	// a compact, approximate membership test that's checked before the hash tables,
+	// so that most misses never have to touch them
+	// it never rejects a point that was inserted, but may let through some that weren't
+	// the Bloom filter sets all of a point's bits within a single 512 bit block,
+	// so a test touches only one cache line
+	// Allocator is used (rebound) for the bits, see map
+	template<uint d, class PosInt, class Allocator = std::allocator<uint64_t>>
+	class prefilter
+	{
+		using IndexInt = size_t;
+		static constexpr IndexInt block_words = 8;
+		static constexpr IndexInt bits_per_element = 10;
+		static constexpr uint num_hashes = 6;
+
+		prefilter_kind type;
+		point<d, PosInt> u_bar;
+		IndexInt u;
+		IndexInt num_blocks;
+		std::vector<uint64_t, typename std::allocator_traits<Allocator>::template rebind_alloc<uint64_t>> words;
+
+	public:
+		prefilter() : type(prefilter_kind::none), u(0), num_blocks(0) { }
+
+		// an empty filter for n elements in a domain with limits u_bar
+		prefilter(prefilter_kind kind, const point<d, PosInt>& u_bar, IndexInt n) : prefilter()
+		{
+			reset(kind, u_bar, n);
+		}
+
+		// empties the filter and sizes it for n elements in a domain with limits u_bar,
+		// reusing its memory if it's large enough, a filter of kind none frees it
+		void reset(prefilter_kind kind, const point<d, PosInt>& new_u_bar, IndexInt n)
+		{
+			type = kind;
+			u_bar = new_u_bar;
+			u = volume(u_bar);
+			num_blocks = 0;
+			if (type == prefilter_kind::automatic)
+				type = u <= n * bits_per_element ? prefilter_kind::bitmap : prefilter_kind::bloom;
+			if (type == prefilter_kind::bitmap)
+				words.assign((u + 63) / 64, 0);
+			else if (type == prefilter_kind::bloom)
+			{
+				num_blocks = std::min(std::max(IndexInt(1), (n * bits_per_element + 511) / 512),
+					IndexInt(1) << 32);
+				words.assign(num_blocks * block_words, 0);
+			}
+			else
+				decltype(words)().swap(words);
+		}
+
+		prefilter_kind kind() const
+		{
+			return type;
+		}
+
+		// can be called from several threads at once
+		void insert(const point<d, PosInt>& p)
+		{
+			if (type == prefilter_kind::bitmap)
+			{
+				// points outside the domain are always let through, so they needn't be stored
+				if (!inside(p))
+					return;
+				auto i = linear(p);
+				atomic_or(words[i / 64], uint64_t(1) << (i % 64));
+			}
+			else if (type == prefilter_kind::bloom)
+			{
+				auto h = mix(linear(p));
+				auto block = words.data() + block_of(h) * block_words;
+				auto bits = block_bits(h);
+				for (uint j = 0; j < num_hashes; j++)
+				{
+					auto bit = bits >> (9 * j) & 511;
+					atomic_or(block[bit / 64], uint64_t(1) << (bit % 64));
+				}
+			}
+		}
+
+		bool may_contain(const point<d, PosInt>& p) const
+		{
+			if (type == prefilter_kind::bitmap)
+			{
+				if (!inside(p))
+					return true;
+				auto i = linear(p);
+				return (words[i / 64] >> (i % 64)) & 1;
+			}
+			else if (type == prefilter_kind::bloom)
+			{
+				auto h = mix(linear(p));
+				auto block = words.data() + block_of(h) * block_words;
+				auto bits = block_bits(h);
+				// no early exit, a miss would be a branch mispredict most of the time anyway
+				uint64_t found = 1;
+				for (uint j = 0; j < num_hashes; j++)
+				{
+					auto bit = bits >> (9 * j) & 511;
+					found &= block[bit / 64] >> (bit % 64);
+				}
+				return found & 1;
+			}
+			return true;
+		}
+
+		size_t memory_size() const
+		{
+			return sizeof(*this) + sizeof(uint64_t) * words.capacity();
+		}
+
+	private:
+		// creds to splitmix64
+		static uint64_t mix(uint64_t x)
+		{
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+			return x ^ (x >> 31);
+		}
+
+		// the index of p in the domain, without reducing it modulo u like point_to_index does,
+		// which would cost a division on every test
+		uint64_t linear(const point<d, PosInt>& p) const
+		{
+			uint64_t output = p[0];
+			for (uint i = 1; i < d; i++)
+			{
+				output = output * u_bar[i] + p[i];
+			}
+			return output;
+		}
+
+		bool inside(const point<d, PosInt>& p) const
+		{
+			for (uint i = 0; i < d; i++)
+			{
+				if (p[i] >= u_bar[i])
+					return false;
+			}
+			return true;
+		}
+
+		// picks a block from the high half of the hash without a division
+		IndexInt block_of(uint64_t h) const
+		{
+			return ((h >> 32) * num_blocks) >> 32;
+		}
+
+		// num_hashes bit indices in a block, 9 bits each
+		static uint64_t block_bits(uint64_t h)
+		{
+			return h * 0x9e3779b97f4a7c15;
+		}
+	};
+}
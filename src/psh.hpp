@@ -1,14 +1,21 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <functional>
+#include <numeric>
 #include <cmath>
 #include <random>
 #include <iostream>
 #include <vector>
+#include <memory>
 #include <unordered_map>
 #include <utility>
 #include <thread>
+#include <iterator>
+#include <stdexcept>
+#include "tbb/blocked_range.h"
+#include "tbb/enumerable_thread_specific.h"
 #include "tbb/parallel_sort.h"
 #include "tbb/parallel_for.h"
 #include "tbb/parallel_for_each.h"
@@ -16,32 +23,56 @@
 #include "tbb/pipeline.h"
 #include "util.hpp"
 #include "point.hpp"
+#include "prefilter.hpp"
+#include "hash.hpp"
 
 #define VALUE(x) std::cout << #x "=" << x << std::endl
 
 namespace psh
 {
+	template<uint d, class T, class PosInt, class HashInt, class Hash = prime_hash<d, PosInt, HashInt>>
+	class packed_map;
+	template<uint d, class T, class PosInt, class HashInt, class Allocator, class Hash>
+	class concurrent_map;
+	template<uint d, class T, class PosInt, class HashInt, class Hash = prime_hash<d, PosInt, HashInt>>
+	class texture_map;
+	template<uint d, class T, class PosInt, class HashInt, class Hash = prime_hash<d, PosInt, HashInt>>
+	class static_map;
+	template<uint d, class T, class PosInt, class HashInt, class Hash = prime_hash<d, PosInt, HashInt>>
+	class mapped_map;
+
 	// creates a perfect hash for a predefined data set
 	// d is the dimensionality, T is the data type
 	// PosInt is the integer type used for positions
 	// HashInt is the integer type used for the position hash
-	template<uint d, class T, class PosInt, class HashInt>
+	// Allocator is used (rebound) for the tables and for all temporary build structures
+	// Hash is the hash policy, see hash.hpp
+	// const functions can be called from several threads at once, as long as nothing
+	// modifies the map at the same time, see concurrent_map for concurrent writes
+	template<uint d, class T, class PosInt, class HashInt, class Allocator = std::allocator<T>,
+		class Hash = prime_hash<d, PosInt, HashInt>>
 	class map
 	{
 		static_assert(d > 0, "d must be larger than 0.");
 		using IndexInt = size_t;
 		class bucket;
 		class entry;
-		class entry_large;
+		friend class packed_map<d, T, PosInt, HashInt, Hash>;
+		friend class concurrent_map<d, T, PosInt, HashInt, Allocator, Hash>;
+		friend class texture_map<d, T, PosInt, HashInt, Hash>;
+		friend class static_map<d, T, PosInt, HashInt, Hash>;
+		friend class mapped_map<d, T, PosInt, HashInt, Hash>;
+
+		template<class V>
+		using alloc_vector = std::vector<V,
+			typename std::allocator_traits<Allocator>::template rebind_alloc<V>>;
 
-		// three primes for use in hashing
-		IndexInt M0;
-		IndexInt M1;
-		IndexInt M2;
+		// the hash functions, with the parameters picked for this build
+		Hash hash;
 		// number of data points
 		IndexInt n;
-		// width of the hash table
-		PosInt m_bar;
+		// width of the hash table in each dimension
+		point<d, PosInt> m_bar;
 		// size of the hash table
 		IndexInt m;
 		// width of the offset table
@@ -49,13 +80,32 @@ namespace psh
 		// size of the offset table
 		IndexInt r;
 		// u_bar is the limit of the domain in each dimension
-		PosInt u_bar;
+		point<d, PosInt> u_bar;
 		// u is the number of elements in the domain
 		IndexInt u;
 		// offset table
-		std::vector<point<d, PosInt>> phi;
-		std::vector<entry> H;
+		alloc_vector<point<d, PosInt>> phi;
+		alloc_vector<entry> H;
+		// the location of the element in each slot of the hash table, and a bitmap
+		// of which slots are occupied, so that the stored elements can be visited
+		// empty unless the map is enumerable, see workspace
+		alloc_vector<point<d, PosInt>> locations;
+		alloc_vector<uint64_t> occupancy;
+		// a byte per slot, taken from the bucket of the stored element, so that lookups can
+		// tell most other points apart without reading H, see get
+		alloc_vector<uint8_t> fingerprints;
 		std::default_random_engine generator;
+		// the most memory used by temporary structures at any point during construction
+		size_t peak_build_memory;
+		// how many offset table sizes the last build tried, including the one that worked
+		IndexInt attempts;
+		// whether the last build fixed the positional hashes, see workspace
+		bool positional_hashes;
+		// whether the last build kept locations, occupancy and fingerprints, see workspace
+		bool enumerable;
+		// optional approximate membership test for find and contains, rebuilt with the map
+		prefilter_kind filter_kind;
+		prefilter<d, PosInt, Allocator> filter;
 
 	public:
 		struct data_t
@@ -64,124 +114,663 @@ namespace psh
 			T contents;
 		};
 		using data_function = std::function<data_t(IndexInt)>;
+		using seed_type = std::default_random_engine::result_type;
+
+	private:
+		// what happened to a single update in apply_updates
+		enum class update_outcome : uint8_t
+		{
+			overwritten,
+			added,
+			superseded,
+			collided
+		};
+
+	public:
+
+		// scratch memory for building maps
+		// passing the same workspace to repeated builds or rebuilds of similarly sized maps
+		// reuses its memory, so they don't have to allocate once it has warmed up
+		class workspace
+		{
+			friend class map;
+			friend class concurrent_map<d, T, PosInt, HashInt, Allocator, Hash>;
+
+			// keep the memory around after a build, otherwise it's freed as early as possible
+			bool keep_memory;
+			// build on the calling thread only, and without progress output, see build_many
+			bool serial;
+			// fix the positional hashes after placing the elements, which takes two sweeps over
+			// the whole domain, without them get compares the stored locations instead,
+			// like find, and the map can't be turned into a packed_map, texture_map, etc.
+			bool positional_hashes;
+			// keep the location, a fingerprint byte and an occupancy bit of every slot after
+			// the build, without them the map only holds phi and H, so it's smaller but can't
+			// be iterated, updated or rebuilt, and every lookup compares the positional hashes
+			bool enumerable;
+			// buckets, with their elements stored back to back in locations and indices
+			alloc_vector<IndexInt> starts;
+			alloc_vector<IndexInt> fill;
+			alloc_vector<bucket> buckets;
+			alloc_vector<point<d, PosInt>> locations;
+			alloc_vector<IndexInt> indices;
+			alloc_vector<IndexInt> bucket_slots;
+			// used by hash_positions, collision_slots and collisions also by rehash_slots
+			alloc_vector<bool> data_b;
+			alloc_vector<uint64_t> collision_slots;
+			alloc_vector<std::pair<IndexInt, IndexInt>> collisions;
+			alloc_vector<IndexInt> collision_starts;
+			// the old contents of a map during a rebuild
+			alloc_vector<data_t> data;
+			// used by apply_updates, repair and rehash_slots
+			alloc_vector<data_t> batch;
+			alloc_vector<std::pair<IndexInt, IndexInt>> targets;
+			alloc_vector<IndexInt> group_starts;
+			alloc_vector<update_outcome> outcomes;
+			alloc_vector<data_t> pending;
+			alloc_vector<data_t> failed;
+			alloc_vector<data_t> elements;
+			alloc_vector<IndexInt> added;
+			alloc_vector<IndexInt> moved;
+			alloc_vector<IndexInt> affected;
+			alloc_vector<std::pair<IndexInt, IndexInt>> members;
+
+		public:
+			explicit workspace(bool keep_memory = true, bool serial = false, bool positional_hashes = true,
+				bool enumerable = true)
+				: keep_memory(keep_memory), serial(serial), positional_hashes(positional_hashes),
+				  enumerable(enumerable) { }
+
+			size_t memory_size() const
+			{
+				return sizeof(*this) + bytes(starts)
+					+ bytes(fill) + bytes(buckets) + bytes(locations) + bytes(indices)
+					+ bytes(bucket_slots) + bytes(data_b) + bytes(collision_slots)
+					+ bytes(collisions) + bytes(collision_starts) + bytes(data)
+					+ bytes(batch) + bytes(targets) + bytes(group_starts) + bytes(outcomes)
+					+ bytes(pending) + bytes(failed) + bytes(elements) + bytes(added)
+					+ bytes(moved) + bytes(affected) + bytes(members);
+			}
+		};
 
 		// data_function maps an index to a data point, n is the total number of data points,
 		// u_bar is the limit of the domain in each dimension
-		map(const data_function& data, IndexInt n, PosInt u_bar)
-			: n(n), m_bar(std::ceil(std::pow(n, 1.0f / d))), m(std::pow(m_bar, d)),
-			  r_bar(std::ceil(std::pow(n / d, 1.0f / d)) - 1), u_bar(u_bar), u(std::pow(u_bar, d)),
-			  generator(time(0))
+		// a location that appears more than once is stored once, with its last contents
+		// a build with a given seed and a serial workspace always gives the same map,
+		// a parallel build uses whichever offset a thread finds first
+		map(const data_function& data, IndexInt n, const point<d, PosInt>& u_bar, workspace& w,
+			seed_type seed = seed_type(time(0)))
+			: n(n), m_bar(table_shape(n, u_bar)), m(volume(m_bar)), r_bar(initial_r_bar(n)),
+			  u_bar(u_bar), u(volume(u_bar)), generator(seed), peak_build_memory(0), attempts(0),
+			  positional_hashes(true), enumerable(true), filter_kind(prefilter_kind::none)
 		{
-			// generate primes, M0 must be different from M1
-			M0 = prime();
-			while ((M1 = prime()) == M0);
-			M2 = prime();
+			build(data, w);
+		}
 
-			VALUE(m);
-			VALUE(uint(m_bar));
+		map(const data_function& data, IndexInt n, const point<d, PosInt>& u_bar, workspace&& w,
+			seed_type seed = seed_type(time(0)))
+			: map(data, n, u_bar, w, seed) { }
 
-			VALUE(M0);
-			VALUE(M1);
-			VALUE(M2);
+		// same as above, with a temporary workspace
+		map(const data_function& data, IndexInt n, const point<d, PosInt>& u_bar)
+			: map(data, n, u_bar, workspace(false)) { }
 
-			std::uniform_int_distribution<IndexInt> m_dist(0, m - 1);
+		// same as above, but with the same limit in every dimension
+		map(const data_function& data, IndexInt n, PosInt u_bar, workspace& w)
+			: map(data, n, point<d, PosInt>::repeating(u_bar), w) { }
+		map(const data_function& data, IndexInt n, PosInt u_bar)
+			: map(data, n, point<d, PosInt>::repeating(u_bar)) { }
 
-			bool create_succeeded = false;
-			do
+		// the input of one map in build_many
+		struct build_input
+		{
+			data_function data;
+			IndexInt n;
+			point<d, PosInt> u_bar;
+		};
+
+		// builds many independent maps at once, the i:th map is built from inputs[i]
+		// maps with fewer than serial_limit elements are built side by side, each one serially
+		// on a single thread, reusing that thread's workspace, so small maps don't pay for
+		// starting parallel work of their own
+		// larger maps are built one at a time afterwards, each with a parallel build
+		static std::vector<map> build_many(const std::vector<build_input>& inputs,
+			IndexInt serial_limit = 4096)
+		{
+			std::vector<IndexInt> small;
+			std::vector<IndexInt> large;
+			for (IndexInt i = 0; i < inputs.size(); i++)
 			{
-				// if we fail, we try again with a larger offset table
-				r_bar += d;
-				r = std::pow(r_bar, d);
-				VALUE(r);
-				VALUE(uint(r_bar));
+				(inputs[i].n < serial_limit ? small : large).push_back(i);
+			}
 
-				create_succeeded = create(data, m_dist);
+			std::vector<std::unique_ptr<map>> built(inputs.size());
+			tbb::enumerable_thread_specific<workspace> workspaces([]()
+				{
+					return workspace(true, true);
+				});
+			tbb::parallel_for(IndexInt(0), small.size(), [&](IndexInt j)
+				{
+					auto& input = inputs[small[j]];
+					built[small[j]].reset(new map(input.data, input.n, input.u_bar, workspaces.local()));
+				});
+			workspace w;
+			for (auto i : large)
+			{
+				built[i].reset(new map(inputs[i].data, inputs[i].n, inputs[i].u_bar, w));
+			}
 
-			} while (!create_succeeded);
+			std::vector<map> output;
+			output.reserve(built.size());
+			for (auto& b : built)
+			{
+				output.push_back(std::move(*b));
+			}
+			return output;
 		}
 
 		T& get(const point<d, PosInt>& p)
+		{
+			return const_cast<T&>(static_cast<const map&>(*this).get(p));
+		}
+		const T& get(const point<d, PosInt>& p) const
 		{
 			// find where the element would be located
-			auto i = point_to_index(h(p), m_bar, m);
-			// but also check that they are equal (have the same positional hash)
-			if (H[i].equals(p, M2))
+			auto b = bucket_of(p);
+			auto i = point_to_index(hash.h0(p) + point<d, IndexInt>(phi[b]), m_bar, m);
+			// the cheap checks go first, an empty slot or a different fingerprint can't match,
+			// so only the rest have to read H and compare the positional hashes
+			// H is prefetched so that for a hit it's read at the same time as the fingerprint
+			PSH_PREFETCH(&H[i]);
+			if ((!enumerable || (occupied(i) && fingerprints[i] == uint8_t(b))) && stored_at(i, p))
 				return H[i].contents;
 			else
 				throw std::out_of_range("Element not found in map");
 		}
-		const T& get(const point<d, PosInt>& p) const
+
+		// the contents stored at p, or nullptr if p isn't in the map
+		// unlike get, this compares the stored location itself, so it's exact even
+		// for points outside the domain the positional hashes were fixed for
+		T* find(const point<d, PosInt>& p)
 		{
-			return get(p);
+			return const_cast<T*>(static_cast<const map&>(*this).find(p));
+		}
+		const T* find(const point<d, PosInt>& p) const
+		{
+			if (!filter.may_contain(p))
+				return nullptr;
+			auto i = slot_of(p);
+			return i == m ? nullptr : &H[i].contents;
 		}
 
+		bool contains(const point<d, PosInt>& p) const
+		{
+			return filter.may_contain(p) && slot_of(p) != m;
+		}
+
+		// builds a prefilter that find and contains check first, so that most misses
+		// don't have to look at the hash tables, worth it when most lookups are misses
+		// it's kept up to date by add, apply_updates and rebuilds
+		// the map has to be enumerable, see workspace
+		void use_prefilter(prefilter_kind kind = prefilter_kind::automatic)
+		{
+			filter_kind = kind;
+			build_prefilter();
+		}
+
+		// looks up a stream of positions and calls f(p, contents) for each of them,
+		// where contents is a pointer to the stored data, or nullptr if p isn't in the map
+		// the lookups are software pipelined: phi is prefetched distance queries ahead
+		// of H, which is prefetched distance queries ahead of the comparison, so the
+		// two dependent cache misses of many lookups overlap instead of adding up
+		template<class InputIt, class F>
+		void lookup_stream(InputIt first, InputIt last, F f, IndexInt distance = 8)
+		{
+			lookup_stream(*this, first, last, f, distance);
+		}
+		template<class InputIt, class F>
+		void lookup_stream(InputIt first, InputIt last, F f, IndexInt distance = 8) const
+		{
+			lookup_stream(*this, first, last, f, distance);
+		}
+
+		// stores p if its slot is empty, or updates it if it's already stored,
+		// returns false if the slot is taken by another element
+		// a new element gets its positional hash fixed against every point of its slot,
+		// which takes a sweep over the domain, so batches are better off with apply_updates
 		bool add(const point<d, PosInt>& p, const T& contents)
 		{
+			require_enumerable();
 			auto i = point_to_index(h(p), m_bar, m);
-			if (H[i].hk == 1)
+			if (!occupied(i))
 			{
-				H[i] = entry(data_t{p, contents}, M2);
+				H[i] = entry(data_t{p, contents}, hash);
+				locations[i] = p;
+				fingerprints[i] = fingerprint(p);
+				set_occupied(i);
+				filter.insert(p);
+				n++;
+				if (positional_hashes)
+				{
+					workspace w(false);
+					w.added.push_back(i);
+					// the slot ran out of values of k, so everything is stored again from scratch
+					if (!rehash_slots(w))
+						rebuild([](IndexInt)
+							{
+								return data_t();
+							}, 0, w);
+				}
 				return true;
 			}
-			else if (H[i].equals(p, M2))
+			else if (stored_at(i, p))
 			{
 				H[i].contents = contents;
-				H[i].rehash(p, M2, H[i].k);
+				H[i].rehash(p, hash, H[i].k);
 				return true;
 			}
 
 			return false;
 		}
 
+		// how a batch of updates ended up being applied
+		struct update_summary
+		{
+			// written over an element already stored at the same location
+			IndexInt overwritten = 0;
+			// stored in a slot that was empty
+			IndexInt added = 0;
+			// stored after moving their bucket to a new offset
+			IndexInt repaired = 0;
+			// stored by rebuilding the whole map
+			IndexInt rebuilt = 0;
+			// replaced by a later update to the same location in the same batch
+			IndexInt superseded = 0;
+		};
+
+		// applies a batch of updates, e.g. a frame's worth of changes
+		// updates are grouped by the slot they hash to and written in place in parallel,
+		// an update that collides with another element gets its bucket moved to a new offset,
+		// and only what can't be placed that way is stored by a single rebuild
+		// if anything was added or moved, one more sweep over the domain fixes the positional
+		// hashes of the slots involved, so get and the hash-only copies still never match
+		// a point that isn't stored
+		// if the same location is updated more than once, the last update wins
+		// all scratch memory comes from the workspace, so with a workspace that keeps its memory
+		// repeated batches of similar sizes don't allocate once it has warmed up
+		update_summary apply_updates(const data_function& updates, IndexInt num_updates, workspace& w)
+		{
+			require_enumerable();
+			update_summary summary;
+			auto& batch = w.batch;
+			batch.clear();
+			for (IndexInt j = 0; j < num_updates; j++)
+			{
+				batch.push_back(updates(j));
+			}
+
+			// (slot, index in the batch), sorted so that updates to the same slot are adjacent
+			// and in the order they were given
+			auto& targets = w.targets;
+			targets.resize(num_updates);
+			for_range(num_updates, w, [&](IndexInt j)
+				{
+					targets[j] = std::make_pair(point_to_index(h(batch[j].location), m_bar, m), j);
+				});
+			sort_range(targets.begin(), targets.end(), w);
+			// the vectors that grow with what the batch turns out to do are reserved for the
+			// worst case, so a warm workspace covers every batch of the same size
+			auto& group_starts = w.group_starts;
+			group_starts.clear();
+			group_starts.reserve(num_updates + 1);
+			for (IndexInt j = 0; j < num_updates; j++)
+			{
+				if (j == 0 || targets[j].first != targets[j - 1].first)
+					group_starts.push_back(j);
+			}
+			group_starts.push_back(num_updates);
+
+			// every group owns its slot, so the groups can write to the table in parallel
+			// the occupancy bitmap is shared between slots, so it's updated afterwards
+			auto& outcomes = w.outcomes;
+			outcomes.resize(num_updates);
+			for_range(group_starts.size() - 1, w, [&](IndexInt g)
+				{
+					auto first = group_starts[g];
+					auto last = group_starts[g + 1];
+					auto i = targets[first].first;
+					bool taken = occupied(i);
+					for (IndexInt j = first; j < last; j++)
+					{
+						auto& update = batch[targets[j].second];
+						bool later = false;
+						for (IndexInt l = j + 1; l < last && !later; l++)
+						{
+							later = batch[targets[l].second].location == update.location;
+						}
+
+						if (later)
+						{
+							outcomes[j] = update_outcome::superseded;
+						}
+						else if (taken && locations[i] == update.location)
+						{
+							H[i].contents = update.contents;
+							outcomes[j] = update_outcome::overwritten;
+						}
+						else if (!taken)
+						{
+							H[i] = entry(update, hash);
+							locations[i] = update.location;
+							fingerprints[i] = fingerprint(update.location);
+							taken = true;
+							outcomes[j] = update_outcome::added;
+						}
+						else
+						{
+							outcomes[j] = update_outcome::collided;
+						}
+					}
+				});
+
+			auto& pending = w.pending;
+			auto& added = w.added;
+			pending.clear();
+			added.clear();
+			pending.reserve(num_updates);
+			added.reserve(num_updates);
+			for (IndexInt j = 0; j < num_updates; j++)
+			{
+				switch (outcomes[j])
+				{
+				case update_outcome::overwritten:
+					summary.overwritten++;
+					break;
+				case update_outcome::added:
+					added.push_back(targets[j].first);
+					set_occupied(targets[j].first);
+					filter.insert(batch[targets[j].second].location);
+					n++;
+					summary.added++;
+					break;
+				case update_outcome::superseded:
+					summary.superseded++;
+					break;
+				case update_outcome::collided:
+					pending.push_back(batch[targets[j].second]);
+					break;
+				}
+			}
+
+			auto& moved = w.moved;
+			moved.clear();
+			if (!pending.empty())
+				summary.repaired = repair(w);
+			// a rebuild fixes every positional hash anyway
+			if (pending.empty() && positional_hashes && (!added.empty() || !moved.empty())
+				&& !rehash_slots(w))
+			{
+				// a slot ran out of values of k, so everything is stored again from scratch
+				summary.rebuilt = summary.added + summary.repaired;
+				summary.added = 0;
+				summary.repaired = 0;
+				rebuild([](IndexInt)
+					{
+						return data_t();
+					}, 0, w);
+			}
+			if (!pending.empty())
+			{
+				summary.rebuilt = pending.size();
+				rebuild([&](IndexInt i)
+					{
+						return pending[i];
+					}, pending.size(), w);
+			}
+			return summary;
+		}
+
+		// same as above, with a temporary workspace in case the map has to be rebuilt
+		update_summary apply_updates(const data_function& updates, IndexInt num_updates)
+		{
+			workspace w(false);
+			return apply_updates(updates, num_updates, w);
+		}
+
 		map rebuild(const data_function& new_data, IndexInt new_n, const std::vector<bool>& data_b)
 		{
+			require_enumerable();
 			std::vector<data_t> data;
 			data.reserve(n + new_n);
-			for (IndexInt i = 0; i < u; i++)
+			// new data replaces whatever is already stored at the same location
+			std::vector<bool> replaced(m, false);
+			for (IndexInt i = 0; i < new_n; i++)
 			{
-				auto p = index_to_point<d, PosInt>(i, u_bar, u);
+				data.push_back(new_data(i));
+				auto j = slot_of(data.back().location);
+				if (j != m)
+					replaced[j] = true;
+			}
+			for (IndexInt i = next_occupied(0); i < m; i = next_occupied(i + 1))
+			{
+				if (!replaced[i])
+					data.push_back(data_t{locations[i], H[i].contents});
+			}
+			for (IndexInt i = 0; i < data_b.size(); i++)
+			{
+				if (!data_b[i])
+					continue;
 				try
 				{
-					data.push_back(data_t{p, get(p)});
+					get(index_to_point<d, PosInt>(i, u_bar, u));
 				}
 				catch (const std::out_of_range& e)
 				{
-					if (data_b[i])
-					{
-						// TODO: investigate when/why this happens
-						std::cout << "OOPS" << std::endl << std::endl;
-						throw "bail out";
-					}
+					// TODO: investigate when/why this happens
+					std::cout << "OOPS" << std::endl << std::endl;
+					throw "bail out";
 				}
 			}
+
+			map output([&](IndexInt i)
+				{
+					return data[i];
+				}, data.size(), u_bar);
+			output.use_prefilter(filter_kind);
+			return output;
+		}
+
+		// same as above, but without checking against a bitmap of the old data
+		map rebuild(const data_function& new_data, IndexInt new_n)
+		{
+			return rebuild(new_data, new_n, std::vector<bool>());
+		}
+
+		// rebuilds the map in place, reusing both its own memory and the workspace
+		void rebuild(const data_function& new_data, IndexInt new_n, workspace& w)
+		{
+			require_enumerable();
+			auto& data = w.data;
+			data.clear();
+			// new data replaces whatever is already stored at the same location,
+			// the table is rebuilt anyway so the old element can simply be forgotten
 			for (IndexInt i = 0; i < new_n; i++)
 			{
 				data.push_back(new_data(i));
+				auto j = slot_of(data.back().location);
+				if (j != m)
+					clear_occupied(j);
+			}
+			for (auto e : *this)
+			{
+				data.push_back(data_t{e.location, e.contents});
 			}
 
-			return map([&](IndexInt i)
+			assign([&](IndexInt i)
 				{
 					return data[i];
-				}, data.size(), u_bar);
+				}, data.size(), w);
+			release(data, w);
+		}
+
+		// replaces the contents of the map with new data, in place, reusing its memory
+		// and the workspace, the domain stays the same
+		void assign(const data_function& new_data, IndexInt new_n, workspace& w)
+		{
+			n = new_n;
+			m_bar = table_shape(n, u_bar);
+			m = volume(m_bar);
+			r_bar = initial_r_bar(n);
+			build(new_data, w);
+		}
+
+		// a stored element, as seen when iterating over the map
+		template<class Contents>
+		struct element
+		{
+			const point<d, PosInt>& location;
+			Contents& contents;
+		};
+
+		// visits the occupied slots of the hash table in order, skipping empty ones
+		// a whole word of the occupancy bitmap at a time
+		template<class Map, class Contents>
+		class slot_iterator
+		{
+			Map* owner;
+			IndexInt i;
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = element<Contents>;
+			using difference_type = std::ptrdiff_t;
+			using pointer = void;
+			using reference = element<Contents>;
+
+			slot_iterator(Map* owner, IndexInt i) : owner(owner), i(owner->next_occupied(i)) { }
+
+			reference operator*() const
+			{
+				return reference{owner->locations[i], owner->H[i].contents};
+			}
+			slot_iterator& operator++()
+			{
+				i = owner->next_occupied(i + 1);
+				return *this;
+			}
+			slot_iterator operator++(int)
+			{
+				auto output = *this;
+				++*this;
+				return output;
+			}
+			friend bool operator==(const slot_iterator& lhs, const slot_iterator& rhs)
+			{
+				return lhs.i == rhs.i;
+			}
+			friend bool operator!=(const slot_iterator& lhs, const slot_iterator& rhs)
+			{
+				return lhs.i != rhs.i;
+			}
+		};
+		using iterator = slot_iterator<map, T>;
+		using const_iterator = slot_iterator<const map, const T>;
+
+		iterator begin() { require_enumerable(); return iterator(this, 0); }
+		iterator end() { return iterator(this, m); }
+		const_iterator begin() const { require_enumerable(); return const_iterator(this, 0); }
+		const_iterator end() const { return const_iterator(this, m); }
+
+		// number of stored elements
+		IndexInt size() const
+		{
+			return n;
+		}
+
+		// calls f(location, contents) for every stored element, in parallel
+		template<class F>
+		void for_each_parallel(F f)
+		{
+			for_each_parallel(*this, f);
+		}
+		template<class F>
+		void for_each_parallel(F f) const
+		{
+			for_each_parallel(*this, f);
+		}
+
+		// all stored elements, sorted in Morton (Z-curve) order so that
+		// elements close to each other in the domain stay close in memory
+		std::vector<data_t> export_morton() const
+		{
+			std::vector<std::pair<uint64_t, data_t>> coded;
+			coded.reserve(n);
+			for (auto e : *this)
+			{
+				coded.emplace_back(morton_code(e.location), data_t{e.location, e.contents});
+			}
+			tbb::parallel_sort(coded.begin(), coded.end(),
+				[](const std::pair<uint64_t, data_t>& lhs, const std::pair<uint64_t, data_t>& rhs)
+				{
+					return lhs.first < rhs.first;
+				});
+
+			std::vector<data_t> output;
+			output.reserve(coded.size());
+			for (auto& kvp : coded)
+			{
+				output.push_back(kvp.second);
+			}
+			return output;
 		}
 
 		size_t memory_size() const
 		{
-			return sizeof(*this)
-				+ sizeof(typename decltype(phi)::value_type) * phi.capacity()
-				+ sizeof(typename decltype(H)::value_type) * H.capacity();
+			return sizeof(*this) + bytes(phi) + bytes(H) + bytes(locations) + bytes(occupancy)
+				+ bytes(fingerprints) + prefilter_memory_size() - sizeof(filter);
+		}
+
+		// the part of memory_size used by the prefilter
+		size_t prefilter_memory_size() const
+		{
+			return filter.memory_size();
+		}
+
+		// the most memory used while constructing the map, including the map itself
+		size_t build_memory_size() const
+		{
+			return peak_build_memory;
+		}
+
+		// the number of slots in the offset table
+		IndexInt offset_table_size() const
+		{
+			return r;
+		}
+
+		// how many offset table sizes the last build or rebuild had to try
+		IndexInt build_attempts() const
+		{
+			return attempts;
 		}
 
 	private:
 		// internal data structures
 
-		// a bucket is simply a vector<data_t> which is then sorted
-		// by the original phi_index (descending order)
-		struct bucket : public std::vector<data_t>
+		// a bucket is a range of elements in the workspace, which is then sorted
+		// by size (descending order)
+		// it only keeps the locations of its elements and their indices in the data set,
+		// the contents are streamed in by index when the bucket is inserted
+		struct bucket
 		{
 			IndexInt phi_index;
+			const point<d, PosInt>* locations;
+			const IndexInt* indices;
+			IndexInt count;
 
-			bucket(IndexInt phi_index) : phi_index(phi_index) { }
+			IndexInt size() const { return count; }
+			const point<d, PosInt>* begin() const { return locations; }
+			const point<d, PosInt>* end() const { return locations + count; }
 			friend bool operator<(const bucket& lhs, const bucket& rhs) {
 				return lhs.size() > rhs.size();
 			}
@@ -198,159 +787,632 @@ namespace psh
 			HashInt hk;
 
 			entry() : contents(T()), k(1), hk(1) { };
-			entry(const data_t& data, IndexInt M2) : contents(data.contents), k(1) 
+			entry(const data_t& data, const Hash& hash) : contents(data.contents), k(1) 
 			{
-				rehash(data, M2);
+				rehash(data, hash);
 			}
 
-			static constexpr HashInt h(const point<d, PosInt>& p, IndexInt M2, HashInt k)
+			void rehash(const point<d, PosInt>& location, const Hash& hash, HashInt new_k = 1)
 			{
-				// p dot {k, k * k, k * k * k...} * M2
-				// creds to David
-				return p * point<d, PosInt>::increasing_pow(k) * M2;
+				k = new_k;
+				hk = hash.hk(location, k);
+			}
+			void rehash(const data_t& data, const Hash& hash, HashInt new_k = 1)
+			{
+				rehash(data.location, hash, new_k);
 			}
 
-			void rehash(const point<d, PosInt>& location, IndexInt M2, HashInt new_k = 1)
+			bool equals(const point<d, PosInt>& p, const Hash& hash) const
 			{
-				k = new_k;
-				hk = h(location, M2, k);
+				return hk == hash.hk(p, k);
 			}
-			void rehash(const data_t& data, IndexInt M2, HashInt new_k = 1)
+		};
+
+		// internal functions
+
+		void require_enumerable() const
+		{
+			if (!enumerable)
+				throw std::logic_error("The map was built without its locations");
+		}
+
+		bool occupied(IndexInt i) const
+		{
+			return (occupancy[i / 64] >> (i % 64)) & 1;
+		}
+		void set_occupied(IndexInt i)
+		{
+			occupancy[i / 64] |= uint64_t(1) << (i % 64);
+		}
+		void clear_occupied(IndexInt i)
+		{
+			occupancy[i / 64] &= ~(uint64_t(1) << (i % 64));
+		}
+
+		// whether p is the element stored in slot i, given that p maps to slot i
+		bool stored_at(IndexInt i, const point<d, PosInt>& p) const
+		{
+			if (positional_hashes)
+				return H[i].equals(p, hash);
+			return occupied(i) && locations[i] == p;
+		}
+
+		// the slot p is stored in, or m if it isn't in the map
+		IndexInt slot_of(const point<d, PosInt>& p) const
+		{
+			auto b = bucket_of(p);
+			auto i = point_to_index(hash.h0(p) + point<d, IndexInt>(phi[b]), m_bar, m);
+			if (!enumerable)
+				return H[i].equals(p, hash) ? i : m;
+			PSH_PREFETCH(&locations[i]);
+			return occupied(i) && fingerprints[i] == uint8_t(b) && locations[i] == p ? i : m;
+		}
+
+		// the index of the offset of p in phi
+		IndexInt bucket_of(const point<d, PosInt>& p) const
+		{
+			return point_to_index(hash.h1(p), r_bar, r);
+		}
+
+		// elements in the same slot almost always come from different buckets, so a byte
+		// of the bucket index tells them apart for free, since lookups compute it anyway
+		uint8_t fingerprint(const point<d, PosInt>& p) const
+		{
+			return uint8_t(bucket_of(p));
+		}
+
+		// local repair for elements that collided with other elements
+		// every bucket with pending elements is moved, together with the elements already
+		// stored in it, to a new offset where all of them fit
+		// returns how many were stored, the rest are left in w.pending
+		// the buckets that were moved are appended to w.moved, in increasing order
+		IndexInt repair(workspace& w)
+		{
+			auto& pending = w.pending;
+			auto& moved = w.moved;
+			auto phi_index = [&](const point<d, PosInt>& p)
+				{
+					return point_to_index(hash.h1(p), r_bar, r);
+				};
+			std::sort(pending.begin(), pending.end(), [&](const data_t& lhs, const data_t& rhs)
+				{
+					return phi_index(lhs.location) < phi_index(rhs.location);
+				});
+			auto& affected = w.affected;
+			affected.clear();
+			affected.reserve(pending.capacity());
+			for (auto& element : pending)
 			{
-				rehash(data.location, M2, new_k);
+				affected.push_back(phi_index(element.location));
 			}
+			affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
 
-			constexpr bool equals(const point<d, PosInt>& p, IndexInt M2) const
+			// (bucket, slot) of the elements already stored in the affected buckets,
+			// found with a single pass over the table
+			auto& members = w.members;
+			members.clear();
+			for (IndexInt i = next_occupied(0); i < m; i = next_occupied(i + 1))
 			{
-				return hk == h(p, M2, k);
+				auto b = phi_index(locations[i]);
+				if (std::binary_search(affected.begin(), affected.end(), b))
+					members.emplace_back(b, i);
 			}
-		};
+			std::sort(members.begin(), members.end());
+
+			IndexInt repaired = 0;
+			auto& failed = w.failed;
+			auto& elements = w.elements;
+			auto& slots = w.bucket_slots;
+			failed.clear();
+			failed.reserve(pending.capacity());
+			auto p = pending.begin();
+			auto q = members.begin();
+			for (auto b : affected)
+			{
+				auto p_end = std::find_if(p, pending.end(), [&](const data_t& element)
+					{
+						return phi_index(element.location) != b;
+					});
+				auto q_end = std::find_if(q, members.end(),
+					[&](const std::pair<IndexInt, IndexInt>& member)
+					{
+						return member.first != b;
+					});
+
+				// the bucket's own elements don't block its new offset
+				elements.clear();
+				for (auto it = q; it != q_end; ++it)
+				{
+					elements.push_back(data_t{locations[it->second], H[it->second].contents});
+					clear_occupied(it->second);
+				}
+				elements.insert(elements.end(), p, p_end);
 
-		// a larger version of entry to also keep the original location
-		// later discarded (using slicing!) for memory efficiency
-		struct entry_large : public entry
+				if (place_bucket(b, elements, slots))
+				{
+					moved.push_back(b);
+					n += p_end - p;
+					repaired += p_end - p;
+				}
+				else
+				{
+					for (auto it = q; it != q_end; ++it)
+					{
+						set_occupied(it->second);
+					}
+					failed.insert(failed.end(), p, p_end);
+				}
+				p = p_end;
+				q = q_end;
+			}
+			pending.swap(failed);
+			return repaired;
+		}
+
+		// looks for a new offset for bucket b that puts all of elements in distinct empty slots,
+		// and stores them there if there is one
+		// tries as many offsets as jiggle_offsets does
+		bool place_bucket(IndexInt b, const alloc_vector<data_t>& elements, alloc_vector<IndexInt>& slots)
 		{
-			point<d, PosInt> location;
-			entry_large() : entry(), location(point<d, PosInt>()) { };
-			entry_large(const data_t& data, IndexInt M2)
-				: entry(data, M2), location(data.location) { };
-			void rehash(IndexInt M2) { entry::rehash(location, M2, entry::k + 1); };
-		};
+			std::uniform_int_distribution<IndexInt> m_dist(0, m - 1);
+			auto start_offset = m_dist(generator);
+			slots.resize(elements.size());
+			for (IndexInt i = 0; i < r; i++)
+			{
+				auto offset = index_to_point<d>((start_offset + i) % m, m_bar, m);
+				bool collision = false;
+				for (IndexInt j = 0; j < elements.size() && !collision; j++)
+				{
+					slots[j] = point_to_index(
+						hash.h0(elements[j].location) + point<d, IndexInt>(offset), m_bar, m);
+					collision = occupied(slots[j])
+						|| std::find(slots.begin(), slots.begin() + j, slots[j]) != slots.begin() + j;
+				}
+				if (collision)
+					continue;
 
-		// internal functions
+				phi[b] = offset;
+				for (IndexInt j = 0; j < elements.size(); j++)
+				{
+					H[slots[j]] = entry(elements[j], hash);
+					locations[slots[j]] = elements[j].location;
+					fingerprints[slots[j]] = fingerprint(elements[j].location);
+					set_occupied(slots[j]);
+					filter.insert(elements[j].location);
+				}
+				return true;
+			}
+			return false;
+		}
 
-		// provides the index in the hash table for a given position in the domain,
-		// optionally with a temporary offset table
-		point<d, PosInt> h(const point<d, PosInt>& p, const decltype(phi)& phi_hat) const
+		// the first occupied slot at or after i, or m if there is none
+		IndexInt next_occupied(IndexInt i) const
 		{
-			auto h0 = p * M0;
-			auto h1 = p * M1;
-			auto i = point_to_index(h1, r_bar, r);
-			auto offset = phi_hat[i];
-			return h0 + offset;
+			while (i < m)
+			{
+				auto word = occupancy[i / 64] >> (i % 64);
+				if (word != 0)
+					return i + count_trailing_zeros(word);
+				i = (i / 64 + 1) * 64;
+			}
+			return m;
+		}
+
+		template<class Map, class InputIt, class F>
+		static void lookup_stream(Map& self, InputIt first, InputIt last, F& f, IndexInt distance)
+		{
+			struct in_flight
+			{
+				point<d, PosInt> p;
+				IndexInt phi_i;
+				IndexInt i;
+			};
+			distance = std::max(distance, IndexInt(1));
+			const IndexInt window = 2 * distance;
+			std::vector<in_flight> ring(window);
+
+			auto prefetch_phi = [&](in_flight& q)
+				{
+					q.phi_i = point_to_index(self.hash.h1(q.p), self.r_bar, self.r);
+					PSH_PREFETCH(&self.phi[q.phi_i]);
+				};
+			auto prefetch_H = [&](in_flight& q)
+				{
+					auto h0 = self.hash.h0(q.p);
+					q.i = point_to_index(h0 + point<d, IndexInt>(self.phi[q.phi_i]), self.m_bar, self.m);
+					PSH_PREFETCH(&self.H[q.i]);
+				};
+			auto complete = [&](in_flight& q)
+				{
+					auto& e = self.H[q.i];
+					f(q.p, self.stored_at(q.i, q.p) ? &e.contents : nullptr);
+				};
+
+			IndexInt issued = 0;
+			for (; first != last; ++first, issued++)
+			{
+				// the oldest query has to finish before its slot in the ring is reused
+				if (issued >= window)
+					complete(ring[issued % window]);
+				if (issued >= distance)
+					prefetch_H(ring[(issued - distance) % window]);
+				ring[issued % window].p = *first;
+				prefetch_phi(ring[issued % window]);
+			}
+
+			// drain whatever is still in flight
+			for (IndexInt j = issued - std::min(issued, distance); j < issued; j++)
+			{
+				prefetch_H(ring[j % window]);
+			}
+			for (IndexInt j = issued - std::min(issued, window); j < issued; j++)
+			{
+				complete(ring[j % window]);
+			}
+		}
+
+		template<class Map, class F>
+		static void for_each_parallel(Map& self, F& f)
+		{
+			self.require_enumerable();
+			tbb::parallel_for(tbb::blocked_range<IndexInt>(0, self.occupancy.size()),
+				[&](const tbb::blocked_range<IndexInt>& range)
+				{
+					for (IndexInt w = range.begin(); w != range.end(); w++)
+					{
+						auto word = self.occupancy[w];
+						while (word != 0)
+						{
+							auto i = w * 64 + count_trailing_zeros(word);
+							word &= word - 1;
+							f(self.locations[i], self.H[i].contents);
+						}
+					}
+				});
+		}
+
+		// this is only the starting point, it grows by d every time creating the map fails
+		static PosInt initial_r_bar(IndexInt n)
+		{
+			return std::ceil(std::pow(n / d, 1.0f / d)) - 1;
+		}
+
+		// picks new primes and tries increasingly large offset tables until a map is created
+		void build(const data_function& data, workspace& w)
+		{
+			hash.pick(generator);
+
+			if (!w.serial)
+			{
+				VALUE(m);
+				VALUE(m_bar);
+
+				VALUE(hash);
+			}
+
+			std::uniform_int_distribution<IndexInt> m_dist(0, m - 1);
+			if (!w.positional_hashes && !w.enumerable)
+				throw std::invalid_argument("A map needs either positional hashes or its locations");
+			peak_build_memory = 0;
+			attempts = 0;
+			positional_hashes = w.positional_hashes;
+			// the build itself needs the locations, they're dropped at the end
+			enumerable = true;
+
+			bool create_succeeded = false;
+			do
+			{
+				attempts++;
+				// if we fail, we try again with a larger offset table
+				r_bar += d;
+				r = std::pow(r_bar, d);
+				if (!w.serial)
+				{
+					VALUE(r);
+					VALUE(uint(r_bar));
+				}
+
+				create_succeeded = create(data, m_dist, w);
+
+			} while (!create_succeeded);
+
+			// duplicate locations were only stored once
+			n = 0;
+			for (auto word : occupancy)
+			{
+				n += count_bits(word);
+			}
+
+			if (!w.serial)
+				VALUE(peak_build_memory);
+			build_prefilter(w.serial);
+			if (!w.enumerable)
+			{
+				enumerable = false;
+				locations = alloc_vector<point<d, PosInt>>(locations.get_allocator());
+				occupancy = alloc_vector<uint64_t>(occupancy.get_allocator());
+				fingerprints = alloc_vector<uint8_t>(fingerprints.get_allocator());
+			}
 		}
-		point<d, PosInt> h(const point<d, PosInt>& p) const
+
+		// fills the prefilter with every stored element, in parallel unless serial is set
+		// the filter keeps its memory from the last build if it's large enough
+		void build_prefilter(bool serial = false)
 		{
-			return h(p, phi);
+			filter.reset(filter_kind, u_bar, n);
+			if (filter_kind == prefilter_kind::none)
+				return;
+			if (serial)
+			{
+				for (auto e : *this)
+				{
+					filter.insert(e.location);
+				}
+			}
+			else
+				for_each_parallel([&](const point<d, PosInt>& location, const T&)
+					{
+						filter.insert(location);
+					});
 		}
 
-		// returns a random prime from a small predefined list
-		IndexInt prime()
+		// provides the index in the hash table for a given position in the domain
+		// the sum is kept at full width so that the offset is a plain translation of h0,
+		// truncating it to PosInt would make the table index depend on the overflow
+		point<d, IndexInt> h(const point<d, PosInt>& p) const
 		{
-			static const std::vector<IndexInt> primes{ 53, 97, 193, 389, 769, 1543, 3079,
-				6151, 12289, 24593, 49157, 98317, 196613, 393241, 786433, 1572869,
-				3145739, 6291469 };
-			static std::uniform_int_distribution<IndexInt> prime_dist(0, primes.size() - 1);
+			auto h0 = hash.h0(p);
+			auto h1 = hash.h1(p);
+			auto i = point_to_index(h1, r_bar, r);
+			auto offset = phi[i];
+			return h0 + point<d, IndexInt>(offset);
+		}
 
-			return primes[prime_dist(generator)];
+		// the hash table follows the shape of the domain, scaled down to fit n elements
+		static point<d, PosInt> table_shape(IndexInt n, const point<d, PosInt>& u_bar)
+		{
+			auto scale = std::pow(double(n) / volume(u_bar), 1.0 / d);
+			point<d, PosInt> output;
+			for (uint i = 0; i < d; i++)
+			{
+				output[i] = std::max(PosInt(1), PosInt(std::ceil(u_bar[i] * scale)));
+			}
+			// rounding might leave the table a bit short, so grow the narrowest dimension
+			while (volume(output) < n)
+			{
+				(*std::min_element(output.data, output.data + d))++;
+			}
+			return output;
 		}
 
-		// tried to create the hash table given a certain offset table size
+		// tries to create the hash table given a certain offset table size
+		// phi and H are built in place, and unless the workspace keeps its memory the
+		// temporary structures are freed as soon as they aren't needed anymore
+		// to keep the peak memory use down
 		bool create(const data_function& data,
-			std::uniform_int_distribution<IndexInt>& m_dist)
+			std::uniform_int_distribution<IndexInt>& m_dist, workspace& w)
 		{
-			// _hats are temporary variables, later moved into the real vectors
-			decltype(phi) phi_hat(r);
-			std::vector<entry_large> H_hat(m);
-			// lookup for whether a certain slot in the hash table contains an entry
-			std::vector<bool> H_b_hat(m, false);
-			std::cout << "creating " << r << " buckets" << std::endl;
+			phi.assign(r, point<d, PosInt>());
+			H.assign(m, entry());
+			locations.assign(m, point<d, PosInt>());
+			occupancy.assign((m + 63) / 64, 0);
+			fingerprints.assign(m, 0);
+			track_memory(w);
+			if (!w.serial)
+				std::cout << "creating " << r << " buckets" << std::endl;
 
 			if (bad_m_r())
 				return false;
 
 			// find out what order we should do the hashing to optimize success rate
-			auto buckets = create_buckets(data);
-			std::cout << "jiggling offsets" << std::endl;
+			create_buckets(data, w);
+			auto& buckets = w.buckets;
+			if (!w.serial)
+				std::cout << "jiggling offsets" << std::endl;
 
-			for (IndexInt i = 0; i < buckets.size(); i++)
+			bool success = true;
+			for (IndexInt i = 0; i < buckets.size() && success; i++)
 			{
 				// if a bucket is empty, then the rest will also be empty
 				if (buckets[i].size() == 0)
 					break;
-				if (i % (buckets.size() / 10) == 0)
+				if (!w.serial && buckets.size() >= 10 && i % (buckets.size() / 10) == 0)
 					std::cout << (100 * i) / buckets.size() << "% done" << std::endl;
 
 				// try to jiggle the offsets until an injective mapping is found
-				if (!jiggle_offsets(H_hat, H_b_hat, phi_hat, buckets[i], m_dist))
+				success = jiggle_offsets(data, buckets[i], m_dist, w);
+			}
+
+			// bucket_slots grew while the offsets were found
+			track_memory(w);
+			release(w.buckets, w);
+			release(w.locations, w);
+			release(w.indices, w);
+			release(w.bucket_slots, w);
+			if (!success)
+				return false;
+
+			if (!w.serial)
+				std::cout << "done!" << std::endl;
+			return !w.positional_hashes || hash_positions(w);
+		}
+
+		// calls f(i) for every i in [0, n), in parallel unless the workspace is serial
+		template<class F>
+		static void for_range(IndexInt n, const workspace& w, F f)
+		{
+			if (w.serial)
+			{
+				for (IndexInt i = 0; i < n; i++)
 				{
-					return false;
+					f(i);
 				}
 			}
+			else
+				tbb::parallel_for(IndexInt(0), n, f);
+		}
 
-			std::cout << "done!" << std::endl;
-			phi = std::move(phi_hat);
-			if (!hash_positions(data, H_hat))
-				return false;
-			H.reserve(H_hat.size());
-			std::copy(H_hat.begin(), H_hat.end(), std::back_inserter(H));
+		template<class It>
+		static void sort_range(It first, It last, const workspace& w)
+		{
+			if (w.serial)
+				std::sort(first, last);
+			else
+				tbb::parallel_sort(first, last);
+		}
 
-			return true;
+		// clears a temporary structure, and frees its memory unless the workspace keeps it
+		template<class V>
+		static void release(V& v, const workspace& w)
+		{
+			if (w.keep_memory)
+				v.clear();
+			else
+				V().swap(v);
+		}
+
+		// keeps track of the peak memory use during construction, called right after
+		// a structure is allocated or grown, before anything else is freed
+		void track_memory(const workspace& w)
+		{
+			peak_build_memory = std::max(peak_build_memory, memory_size() + w.memory_size());
+		}
+
+		template<class V, class A>
+		static size_t bytes(const std::vector<V, A>& v)
+		{
+			return sizeof(V) * v.capacity();
+		}
+		template<class A>
+		static size_t bytes(const std::vector<bool, A>& v)
+		{
+			return v.capacity() / 8;
 		}
 
 		// certain values for m_bar and r_bar are bad, empirically found to be if:
 		// m_bar is coprime with r_bar <==> gcd(m_bar, r_bar) != 1 <==> m_bar % r_bar ∈ {1, r_bar - 1}
-		// creds to Euclid
-		bool bad_m_r()
+		// in any dimension, creds to Euclid
+		bool bad_m_r() const
 		{
-			auto m_mod_r = m_bar % r_bar;
-			return m_mod_r == 1 || m_mod_r == r_bar - 1;
+			return bad_m_r(m_bar, r_bar);
+		}
+		static bool bad_m_r(const point<d, PosInt>& m_bar, PosInt r_bar)
+		{
+			for (uint i = 0; i < d; i++)
+			{
+				// a dimension with a single slot can't have collisions, tiny maps (e.g. chunks) hit this
+				if (m_bar[i] == 1)
+					continue;
+				auto m_mod_r = m_bar[i] % r_bar;
+				if (m_mod_r == 1 || m_mod_r == r_bar - 1)
+					return true;
+			}
+			return false;
 		}
 
 		// creates buckets, each buckets corresponds to one entry in the offset table
 		// they are then sorted by their index in the offset table so we can assign
 		// the largest buckets first
-		std::vector<bucket> create_buckets(const data_function& data)
+		// the data is streamed twice, once to count the size of each bucket
+		// and once to fill them, instead of growing r separate vectors
+		void create_buckets(const data_function& data, workspace& w)
 		{
-			std::vector<bucket> buckets;
-			buckets.reserve(r);
+			auto& starts = w.starts;
+			starts.assign(r + 1, 0);
+			track_memory(w);
+			for (IndexInt i = 0; i < n; i++)
 			{
-				IndexInt i = 0;
-				std::generate_n(std::back_inserter(buckets), r, [&] {
-						return bucket(i++);
-					});
+				auto h1 = hash.h1(data(i).location);
+				starts[point_to_index(h1, r_bar, r) + 1]++;
 			}
+			std::partial_sum(starts.begin(), starts.end(), starts.begin());
 
+			w.locations.resize(n);
+			w.indices.resize(n);
+			w.fill.assign(starts.begin(), starts.end());
+			track_memory(w);
 			for (IndexInt i = 0; i < n; i++)
 			{
-				auto element = data(i);
-				auto h1 = element.location * M1;
-				buckets[point_to_index(h1, r_bar, r)].push_back(element);
+				auto location = data(i).location;
+				auto h1 = hash.h1(location);
+				auto j = w.fill[point_to_index(h1, r_bar, r)]++;
+				w.locations[j] = location;
+				w.indices[j] = i;
 			}
 
-			std::cout << "buckets created" << std::endl;
+			// a location that's given more than once would make its bucket impossible to place,
+			// so only its last occurrence is kept, the same as adding it over and over again
+			// the elements of a bucket are still in the order they were given at this point
+			auto& order = w.bucket_slots;
+			for (IndexInt i = 0; i < r; i++)
+			{
+				if (w.fill[i] - starts[i] < 2)
+					continue;
+				order.clear();
+				for (IndexInt j = starts[i]; j < w.fill[i]; j++)
+				{
+					order.push_back(j);
+				}
+				std::sort(order.begin(), order.end(), [&](IndexInt lhs, IndexInt rhs)
+					{
+						auto& p = w.locations[lhs];
+						auto& q = w.locations[rhs];
+						if (p == q)
+							return lhs < rhs;
+						return std::lexicographical_compare(p.data, p.data + d, q.data, q.data + d);
+					});
+				IndexInt kept = 0;
+				for (IndexInt j = 0; j < order.size(); j++)
+				{
+					if (j + 1 == order.size() || !(w.locations[order[j + 1]] == w.locations[order[j]]))
+						order[kept++] = order[j];
+				}
+				order.resize(kept);
+				// moving the kept elements down in order never overwrites one that's still needed
+				std::sort(order.begin(), order.end());
+				auto end = starts[i];
+				for (auto j : order)
+				{
+					w.locations[end] = w.locations[j];
+					w.indices[end] = w.indices[j];
+					end++;
+				}
+				w.fill[i] = end;
+			}
+			track_memory(w);
+			release(order, w);
 
-			tbb::parallel_sort(buckets.begin(), buckets.end());
-			std::cout << "buckets sorted" << std::endl;
+			// empty buckets don't need an offset, so they're left out entirely
+			w.buckets.clear();
+			w.buckets.reserve(std::min(r, n));
+			for (IndexInt i = 0; i < r; i++)
+			{
+				if (w.fill[i] == starts[i])
+					continue;
+				w.buckets.push_back(bucket{i, w.locations.data() + starts[i],
+					w.indices.data() + starts[i], w.fill[i] - starts[i]});
+			}
+			track_memory(w);
+			release(starts, w);
+			release(w.fill, w);
 
-			return buckets;
+			if (!w.serial)
+				std::cout << "buckets created" << std::endl;
+			sort_range(w.buckets.begin(), w.buckets.end(), w);
+			if (!w.serial)
+				std::cout << "buckets sorted" << std::endl;
 		}
 
 		// jiggle offsets to avoid collisions
-		bool jiggle_offsets(std::vector<entry_large>& H_hat, std::vector<bool>& H_b_hat,
-			decltype(phi)& phi_hat, const bucket& b,
-			std::uniform_int_distribution<IndexInt>& m_dist)
+		bool jiggle_offsets(const data_function& data, const bucket& b,
+			std::uniform_int_distribution<IndexInt>& m_dist, workspace& w)
 		{
+			// all elements in a bucket share the same offset, so if two of them collide
+			// without an offset they will collide with every offset
+			if (!bucket_injective(b, w))
+				return false;
+
+
 			// start at a random point
 			auto start_offset = m_dist(generator);
 
@@ -358,177 +1420,234 @@ namespace psh
 			point<d, PosInt> found_offset;
 			tbb::mutex mutex;
 
-			IndexInt chunk_index = 0;
-			const IndexInt num_cores = std::thread::hardware_concurrency();
-			const IndexInt group_size = r / num_cores + 1;
+			// whether the i:th offset from the start maps the bucket to free slots only
+			auto fits = [&](IndexInt i, point<d, PosInt>& phi_offset)
+				{
+					// wrap around m to stay inside the table
+					phi_offset = index_to_point<d>((start_offset + i) % m, m_bar, m);
 
-			tbb::parallel_pipeline(num_cores,
-				// a serial filter picks up (num_offsets / num_cores) indices
-				tbb::make_filter<void, IndexInt>(tbb::filter::serial,
-					[&, group_size](tbb::flow_control& fc) {
-						if (found || chunk_index >= r)
-						{
-							fc.stop();
-						}
-						chunk_index += group_size;
-						return chunk_index;
-					}) &
-				// and runs each chunk in parallel
-				tbb::make_filter<IndexInt, void>(tbb::filter::parallel,
-					[&, group_size](IndexInt i0)
+					for (auto& location : b)
 					{
-						for (IndexInt i = i0; i < i0 + group_size && !found; i++)
-						{
-							// wrap around m to stay inside the table
-							auto phi_offset = index_to_point<d>((start_offset + i) % m, m_bar, m);
+						auto h0 = hash.h0(location);
+						auto h1 = hash.h1(location);
+						auto index = point_to_index(h1, r_bar, r);
+						// use existing offsets for others, but if the current index
+						// is the one we're jiggling, we use the temporary offset
+						auto offset = index == b.phi_index ? phi_offset : phi[index];
+						auto hash = h0 + point<d, IndexInt>(offset);
+
+						// if the index is already used, this offset is invalid
+						if (occupied(point_to_index(hash, m_bar, m)))
+							return false;
+					}
+					return true;
+				};
+
+			if (w.serial)
+			{
+				for (IndexInt i = 0; i < r && !found; i++)
+				{
+					found = fits(i, found_offset);
+				}
+			}
+			else
+			{
+				IndexInt chunk_index = 0;
+				const IndexInt num_cores = std::thread::hardware_concurrency();
+				const IndexInt group_size = r / num_cores + 1;
 
-							bool collision = false;
-							for (auto& element : b)
+				tbb::parallel_pipeline(num_cores,
+					// a serial filter picks up (num_offsets / num_cores) indices
+					tbb::make_filter<void, IndexInt>(tbb::filter::serial,
+						[&, group_size](tbb::flow_control& fc) {
+							if (found || chunk_index >= r)
 							{
-								auto h0 = element.location * M0;
-								auto h1 = element.location * M1;
-								auto index = point_to_index(h1, r_bar, r);
-								// use existing offsets for others, but if the current index
-								// is the one we're jiggling, we use the temporary offset
-								auto offset = index == b.phi_index ? phi_offset : phi_hat[index];
-								auto hash = h0 + offset;
-
-								// if the index is already used, this offset is invalid
-								collision = H_b_hat[point_to_index(hash, m_bar, m)];
-								if (collision)
-									break;
+								fc.stop();
 							}
-
-							// if there were no collisions, we succeeded
-							if (!collision)
+							chunk_index += group_size;
+							return chunk_index;
+						}) &
+					// and runs each chunk in parallel
+					tbb::make_filter<IndexInt, void>(tbb::filter::parallel,
+						[&, group_size](IndexInt i0)
+						{
+							for (IndexInt i = i0; i < i0 + group_size && !found; i++)
 							{
-								// lock out other threads
-								tbb::mutex::scoped_lock lock(mutex);
-								if (!found)
+								// if there were no collisions, we succeeded
+								point<d, PosInt> phi_offset;
+								if (fits(i, phi_offset))
 								{
-									// this MIGHT get overwritten more than once, but that's okay,
-									// we only need one to succeed, not specifically the first
-									found = true;
-									found_offset = phi_offset;
+									// lock out other threads
+									tbb::mutex::scoped_lock lock(mutex);
+									if (!found)
+									{
+										// this MIGHT get overwritten more than once, but that's okay,
+										// we only need one to succeed, not specifically the first
+										found = true;
+										found_offset = phi_offset;
+									}
 								}
 							}
-						}
-					})
-				);
+						})
+					);
+			}
 			if (found)
 			{
 				// if we found a valid offset, insert it
-				phi_hat[b.phi_index] = found_offset;
-				insert(b, H_hat, H_b_hat, phi_hat);
+				phi[b.phi_index] = found_offset;
+				insert(data, b);
 				return true;
 			}
 			return false;
 		}
 
-		// permanently inserts a bucket into a temporary hash table
-		void insert(const bucket& b, std::vector<entry_large>& H_hat, std::vector<bool>& H_b_hat,
-			const decltype(phi)& phi_hat)
+		// checks that no two elements in a bucket map to the same slot
+		bool bucket_injective(const bucket& b, workspace& w) const
 		{
-			for (auto& element : b)
+			auto& indices = w.bucket_slots;
+			indices.clear();
+			for (auto& location : b)
 			{
-				auto hashed = h(element.location, phi_hat);
+				indices.push_back(point_to_index(hash.h0(location), m_bar, m));
+			}
+			std::sort(indices.begin(), indices.end());
+			return std::adjacent_find(indices.begin(), indices.end()) == indices.end();
+		}
+
+		// permanently inserts a bucket into the hash table, streaming in the contents
+		void insert(const data_function& data, const bucket& b)
+		{
+			for (IndexInt j = 0; j < b.size(); j++)
+			{
+				auto hashed = h(b.locations[j]);
 				auto i = point_to_index(hashed, m_bar, m);
-				H_hat[i] = entry_large(element, M2);
+				H[i] = entry(data(b.indices[j]), hash);
+				locations[i] = b.locations[j];
+				fingerprints[i] = fingerprint(b.locations[j]);
 				// mark off the slot as used
-				H_b_hat[i] = true;
+				set_occupied(i);
 			}
 		}
 
-		bool hash_positions(const data_function& data,
-			std::vector<entry_large>& H_hat)
+		bool hash_positions(workspace& w)
 		{
-			// u_bar - 1 to get the highest indices in each direction
-			// width is assumed to be equal in all directions
-			// and then add 1 to get the size, not the index
-			IndexInt domain_i_max = point_to_index(
-				point<d, PosInt>::repeating(u_bar) - PosInt(1),
-				u_bar, IndexInt(-1)) + 1;
-
 			tbb::mutex mutex;
 
 			// in the first sweep we go through all points in the domain without a data entry
-			std::vector<bool> indices(m, false);
+			// a bitmap of slots, written from several threads at once, so it's set word-wise
+			auto& indices = w.collision_slots;
+			indices.assign((m + 63) / 64, 0);
+			auto collides = [&](IndexInt l)
+				{
+					return (indices[l / 64] >> (l % 64)) & 1;
+				};
 			{
-				std::vector<bool> data_b(domain_i_max);
-				for (IndexInt i = 0; i < n; i++)
+				auto& data_b = w.data_b;
+				data_b.assign(u, false);
+				track_memory(w);
+				for (auto e : *this)
 				{
-					data_b[point_to_index(data(i).location, u_bar, domain_i_max)] = true;
+					data_b[point_to_index(e.location, u_bar, u)] = true;
 				}
-				tbb::parallel_for(IndexInt(0), domain_i_max, [&](IndexInt i)
+
+				for_range(u, w, [&](IndexInt i)
 					{
 						if (data_b[i])
 						{
 							return;
 						}
 
-						auto p = index_to_point<d, PosInt>(i, u_bar, domain_i_max);
+						auto p = index_to_point<d, PosInt>(i, u_bar, u);
 						auto l = point_to_index(h(p), m_bar, m);
 
 						// if their position hash collides with the existing element..
-						if (H_hat[l].hk == entry::h(p, M2, 1))
+						if (H[l].hk == hash.hk(p, 1))
 						{
 							// ..remember the index
-							indices[l] = true;
+							atomic_or(indices[l / 64], uint64_t(1) << (l % 64));
 						}
 					});
-				std::cout << "data size: " << n << std::endl;
-				std::cout << "indices size: " << indices.size() << std::endl;
+				if (!w.serial)
+				{
+					std::cout << "data size: " << n << std::endl;
+					std::cout << "indices size: " << m << std::endl;
+				}
+				release(data_b, w);
 			}
 
 			// in the second sweep we go through the stored indices, and
 			// remember all points in the domain that map to that same index,
 			// regardless of whether that point has data or not
-			std::unordered_map<IndexInt, std::vector<IndexInt>> collisions;
-			tbb::parallel_for(IndexInt(0), domain_i_max, [&](IndexInt i)
+			// they're kept as (index, point) pairs, sorted so each index forms a group
+			auto& collisions = w.collisions;
+			collisions.clear();
+			for_range(u, w, [&](IndexInt i)
 				{
 					// for each point p in original image
 
-					auto p = index_to_point<d, PosInt>(i, u_bar, domain_i_max);
+					auto p = index_to_point<d, PosInt>(i, u_bar, u);
 					auto l = point_to_index(h(p), m_bar, m);
 
 					// collect everyone that maps to the same thing
-					if (indices[l])
+					if (collides(l))
 					{
 						tbb::mutex::scoped_lock lock(mutex);
-						collisions[l].push_back(i);
+						collisions.emplace_back(l, i);
 					}
 				});
+			track_memory(w);
+			release(indices, w);
+			sort_range(collisions.begin(), collisions.end(), w);
+
+			auto& starts = w.collision_starts;
+			starts.clear();
+			for (IndexInt j = 0; j < collisions.size(); j++)
+			{
+				if (j == 0 || collisions[j].first != collisions[j - 1].first)
+					starts.push_back(j);
+			}
+			starts.push_back(collisions.size());
+
+			track_memory(w);
 
 			// in the third sweep we try to change the positional hash parameter until it works
 			bool success = true;
-			tbb::parallel_for_each(collisions.begin(), collisions.end(),
-				[&](const decltype(collisions)::value_type& kvp)
+			for_range(starts.size() - 1, w, [&](IndexInt j)
 				{
-					if (!fix_k(H_hat[kvp.first], kvp.second))
+					auto first = collisions.begin() + starts[j];
+					auto last = collisions.begin() + starts[j + 1];
+					auto l = first->first;
+					if (!fix_k(H[l], locations[l], occupied(l), first, last))
 					{
 						tbb::mutex::scoped_lock lock(mutex);
 						success = false;
 					}
 				});
+			release(collisions, w);
+			release(starts, w);
 			return success;
 		}
 
-		// try all values for the positional hash parameter until it works 
-		bool fix_k(entry_large& H_entry, const std::vector<IndexInt>& collisions)
+		// try all values for the positional hash parameter until it works
+		// the collisions are the (index, point) pairs from hash_positions
+		// an empty slot must not match any of them, not even its stale location
+		template<class It>
+		bool fix_k(entry& H_entry, const point<d, PosInt>& location, bool stored, It first, It last)
 		{
-			H_entry.rehash(M2);
+			H_entry.rehash(location, hash, H_entry.k + 1);
 			// if k == 0, we've rolled around and already tried all the values
 			if (H_entry.k == 0)
 				return false;
 
 			bool success = true;
-			for (IndexInt i : collisions)
+			for (auto it = first; it != last; ++it)
 			{
 				// i is the index in the domain
+				auto i = it->second;
 				// fail if one of these have the same positional hash as the entry in the hash table
-				auto p = index_to_point<d, PosInt>(i, u_bar, IndexInt(-1));
-				auto hk = entry::h(p, M2, H_entry.k);
-				if (H_entry.location != p && H_entry.hk == hk)
+				auto p = index_to_point<d, PosInt>(i, u_bar, u);
+				auto hk = hash.hk(p, H_entry.k);
+				if ((!stored || location != p) && H_entry.hk == hk)
 				{
 					success = false;
 					break;
@@ -536,8 +1655,74 @@ namespace psh
 			}
 			// if we didn't find a valid k, recursively move on to the next k
 			if (!success)
-				return fix_k(H_entry, collisions);
+				return fix_k(H_entry, location, stored, first, last);
 			return true;
 		}
+
+		// fixes the positional hashes after elements were stored or moved without a rebuild
+		// the set of domain points that maps to a slot changed for every slot an element was
+		// added to, and for every slot a point of a moved bucket maps to now, whether it's
+		// stored or not, so those slots pick their k again against all of their points
+		// the slots that moved buckets left keep their k, they only lost points
+		// w.added are slots and w.moved are buckets, in increasing order
+		// returns false if a slot has no k left that works
+		bool rehash_slots(workspace& w)
+		{
+			auto& added = w.added;
+			auto& moved = w.moved;
+			auto& marked = w.collision_slots;
+			marked.assign(occupancy.size(), 0);
+			for (auto l : added)
+			{
+				marked[l / 64] |= uint64_t(1) << (l % 64);
+			}
+			auto is_marked = [&](IndexInt l)
+				{
+					return (marked[l / 64] >> (l % 64)) & 1;
+				};
+			if (!moved.empty())
+			{
+				for_range(u, w, [&](IndexInt i)
+					{
+						auto p = index_to_point<d, PosInt>(i, u_bar, u);
+						if (!std::binary_search(moved.begin(), moved.end(), bucket_of(p)))
+							return;
+						auto l = point_to_index(h(p), m_bar, m);
+						atomic_or(marked[l / 64], uint64_t(1) << (l % 64));
+					});
+			}
+
+			// every point that maps to a marked slot, as (slot, index in the domain)
+			tbb::mutex mutex;
+			auto& collisions = w.collisions;
+			collisions.clear();
+			for_range(u, w, [&](IndexInt i)
+				{
+					auto l = point_to_index(h(index_to_point<d, PosInt>(i, u_bar, u)), m_bar, m);
+					if (is_marked(l))
+					{
+						tbb::mutex::scoped_lock lock(mutex);
+						collisions.emplace_back(l, i);
+					}
+				});
+			sort_range(collisions.begin(), collisions.end(), w);
+
+			bool success = true;
+			for (IndexInt j = 0; j < collisions.size() && success; )
+			{
+				auto l = collisions[j].first;
+				auto end = j;
+				while (end < collisions.size() && collisions[end].first == l)
+				{
+					end++;
+				}
+				// start over from k = 1, the old k was picked for other points
+				H[l].k = 0;
+				success = fix_k(H[l], locations[l], occupied(l), collisions.begin() + j,
+					collisions.begin() + end);
+				j = end;
+			}
+			return success;
+		}
 	};
 }
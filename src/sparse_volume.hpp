@@ -0,0 +1,380 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "psh.hpp"
+
+namespace psh
+{
+	// a read-only front end for a map of bricks (e.g. voxelgroup), with box and ray queries
+	// next to the map it keeps an occupancy mip pyramid: level l has one bit for every
+	// block of 2^l bricks in each dimension, set if any brick in that block is stored
+	// queries descend the pyramid and skip empty blocks whole, and only the bricks in
+	// non-empty blocks of the finest level are looked up, as a batch with lookup_stream
+	template<uint d, class T, class PosInt, class HashInt>
+	class sparse_volume
+	{
+		using IndexInt = size_t;
+
+	public:
+		using map = psh::map<d, T, PosInt, HashInt>;
+		using brick = point<d, PosInt>;
+		// a position or direction in brick units
+		using position = point<d, float>;
+
+		// the first stored brick along a ray
+		struct hit
+		{
+			brick location;
+			const T* contents;
+			// where the ray enters the brick, in units of the direction's length
+			float t;
+		};
+
+	private:
+		struct level
+		{
+			point<d, IndexInt> width;
+			std::vector<uint64_t> bits;
+		};
+
+		map s;
+		point<d, PosInt> u_bar;
+		// levels[l] covers blocks of 2^(l + 1) bricks, the last one is a single block
+		std::vector<level> levels;
+		// how many lookups a query collects before looking them up together
+		static constexpr IndexInt batch_size = 256;
+
+	public:
+		// takes over a finished map, u_bar is the limit of the domain in each dimension
+		sparse_volume(map&& s, const point<d, PosInt>& u_bar) : s(std::move(s)), u_bar(u_bar)
+		{
+			point<d, IndexInt> width(u_bar);
+			do
+			{
+				bool done = true;
+				for (uint i = 0; i < d; i++)
+				{
+					width[i] = (width[i] + 1) / 2;
+					done = done && width[i] == 1;
+				}
+				levels.push_back(level{width, std::vector<uint64_t>((volume(width) + 63) / 64, 0)});
+				if (done)
+					break;
+			} while (true);
+
+			for (auto e : this->s)
+			{
+				point<d, IndexInt> block(e.location);
+				for (auto& l : levels)
+				{
+					for (uint i = 0; i < d; i++)
+					{
+						block[i] /= 2;
+					}
+					auto j = block_index(l, block);
+					l.bits[j / 64] |= uint64_t(1) << (j % 64);
+				}
+			}
+		}
+
+		const map& contents() const
+		{
+			return s;
+		}
+
+		// calls f(location, contents) for every stored brick in the box [min, max)
+		template<class F>
+		void query_box(const brick& min, const brick& max, F f) const
+		{
+			std::vector<brick> batch;
+			batch.reserve(batch_size);
+			auto flush = [&]()
+				{
+					s.lookup_stream(batch.begin(), batch.end(), [&](const brick& p, const T* contents)
+						{
+							if (contents != nullptr)
+								f(p, *contents);
+						});
+					batch.clear();
+				};
+
+			// (level, block), where level 0 is a single brick
+			std::vector<std::pair<uint, point<d, IndexInt>>> stack;
+			stack.emplace_back(levels.size(), point<d, IndexInt>());
+			while (!stack.empty())
+			{
+				auto l = stack.back().first;
+				auto block = stack.back().second;
+				stack.pop_back();
+
+				// the range of bricks covered by the block, clipped to the box
+				point<d, IndexInt> first;
+				point<d, IndexInt> last;
+				bool inside = true;
+				for (uint i = 0; i < d && inside; i++)
+				{
+					first[i] = std::max(block[i] << l, IndexInt(min[i]));
+					last[i] = std::min((block[i] + 1) << l, IndexInt(std::min(max[i], u_bar[i])));
+					inside = first[i] < last[i];
+				}
+				if (!inside || (l > 0 && !occupied(l, block)))
+					continue;
+
+				if (l == 0)
+				{
+					batch.push_back(brick(block));
+					if (batch.size() == batch_size)
+						flush();
+					continue;
+				}
+				for (IndexInt c = 0; c < (IndexInt(1) << d); c++)
+				{
+					point<d, IndexInt> child;
+					for (uint i = 0; i < d; i++)
+					{
+						child[i] = block[i] * 2 + ((c >> i) & 1);
+					}
+					stack.emplace_back(l - 1, child);
+				}
+			}
+			flush();
+		}
+
+		// finds the first stored brick along the ray origin + t * direction, for t in [0, max_t]
+		// the ray is traversed with an integer DDA, but skips every empty block of the pyramid
+		// at once, and the bricks it passes in a non-empty block of the finest level are
+		// looked up together
+		bool raycast(const position& origin, const position& direction, hit& output,
+			float max_t = std::numeric_limits<float>::infinity()) const
+		{
+			// clip the ray to the domain
+			float t = 0;
+			float t_end = max_t;
+			for (uint i = 0; i < d; i++)
+			{
+				if (direction[i] == 0)
+				{
+					if (origin[i] < 0 || origin[i] >= u_bar[i])
+						return false;
+					continue;
+				}
+				float t0 = -origin[i] / direction[i];
+				float t1 = (u_bar[i] - origin[i]) / direction[i];
+				t = std::max(t, std::min(t0, t1));
+				t_end = std::min(t_end, std::max(t0, t1));
+			}
+			if (t >= t_end)
+				return false;
+
+			// the brick the ray enters the domain in, clamped in case rounding put it just outside
+			dda_state ray;
+			for (uint i = 0; i < d; i++)
+			{
+				float x = std::floor(origin[i] + direction[i] * t);
+				ray.current[i] = IndexInt(std::min(std::max(x, 0.0f), float(u_bar[i] - 1)));
+			}
+			ray.t = t;
+			crossings(origin, direction, ray);
+
+			// a line passes at most 2^d bricks of a block of 2^d bricks
+			brick batch[1 << d];
+			float entries[1 << d];
+			bool inside = true;
+			while (inside && ray.t < t_end)
+			{
+				// find the largest empty block around the current brick
+				uint l = 0;
+				while (l < levels.size() && !occupied(l + 1, shift(ray.current, l + 1)))
+				{
+					l++;
+				}
+				if (l > 0)
+				{
+					inside = leave_block(origin, direction, l, ray);
+					continue;
+				}
+
+				// the block of 2^d bricks around the current brick isn't empty,
+				// so collect every brick the ray passes in it and look them up together
+				auto block = shift(ray.current, 1);
+				IndexInt count = 0;
+				while (inside && ray.t < t_end && shift(ray.current, 1) == block && count < (1 << d))
+				{
+					batch[count] = brick(ray.current);
+					entries[count] = ray.t;
+					count++;
+					inside = step(origin, direction, ray);
+				}
+
+				bool found = false;
+				IndexInt j = 0;
+				s.lookup_stream(batch, batch + count, [&](const brick& p, const T* contents)
+					{
+						if (!found && contents != nullptr)
+						{
+							output = hit{p, contents, entries[j]};
+							found = true;
+						}
+						j++;
+					}, count);
+				if (found)
+					return true;
+			}
+			return false;
+		}
+
+		// the number of levels in the pyramid, not counting the bricks themselves
+		uint num_levels() const
+		{
+			return levels.size();
+		}
+
+		size_t memory_size() const
+		{
+			size_t output = sizeof(*this) - sizeof(s) + s.memory_size()
+				+ sizeof(level) * levels.capacity();
+			for (auto& l : levels)
+			{
+				output += sizeof(uint64_t) * l.bits.capacity();
+			}
+			return output;
+		}
+
+	private:
+		static IndexInt block_index(const level& l, const point<d, IndexInt>& block)
+		{
+			IndexInt output = block[0];
+			for (uint i = 1; i < d; i++)
+			{
+				output = output * l.width[i] + block[i];
+			}
+			return output;
+		}
+
+		// whether anything is stored in the given block of 2^l bricks, for l >= 1
+		bool occupied(uint l, const point<d, IndexInt>& block) const
+		{
+			auto& lv = levels[l - 1];
+			auto j = block_index(lv, block);
+			return (lv.bits[j / 64] >> (j % 64)) & 1;
+		}
+
+		static point<d, IndexInt> shift(const point<d, IndexInt>& p, uint l)
+		{
+			point<d, IndexInt> output;
+			for (uint i = 0; i < d; i++)
+			{
+				output[i] = p[i] >> l;
+			}
+			return output;
+		}
+
+		// where a ray is: the brick it's in, the t it entered that brick at,
+		// and for each axis the t it crosses into the next brick along that axis
+		struct dda_state
+		{
+			point<d, IndexInt> current;
+			float t;
+			position t_max;
+		};
+
+		// the t where the ray crosses into the next brick along axis i, computed from the brick
+		// instead of accumulated, so the error doesn't grow with the length of the ray
+		static float crossing(const position& origin, const position& direction,
+			const dda_state& ray, uint i)
+		{
+			if (direction[i] == 0)
+				return std::numeric_limits<float>::infinity();
+			return (float(ray.current[i] + (direction[i] > 0 ? 1 : 0)) - origin[i]) / direction[i];
+		}
+		static void crossings(const position& origin, const position& direction, dda_state& ray)
+		{
+			for (uint i = 0; i < d; i++)
+			{
+				ray.t_max[i] = crossing(origin, direction, ray, i);
+			}
+		}
+
+		// moves the ray to the next brick, or returns false if that's outside the domain
+		// only integer coordinates are stepped, so the ray always makes progress
+		bool step(const position& origin, const position& direction, dda_state& ray) const
+		{
+			uint a = 0;
+			for (uint i = 1; i < d; i++)
+			{
+				if (ray.t_max[i] < ray.t_max[a])
+					a = i;
+			}
+			if (ray.t_max[a] == std::numeric_limits<float>::infinity())
+				return false;
+			ray.t = std::max(ray.t, ray.t_max[a]);
+			if (direction[a] > 0)
+			{
+				if (++ray.current[a] >= u_bar[a])
+					return false;
+			}
+			else
+			{
+				if (ray.current[a] == 0)
+					return false;
+				ray.current[a]--;
+			}
+			ray.t_max[a] = crossing(origin, direction, ray, a);
+			return true;
+		}
+
+		// moves the ray out of the block of 2^l bricks around it in one go,
+		// or returns false if it leaves the domain there
+		bool leave_block(const position& origin, const position& direction, uint l, dda_state& ray) const
+		{
+			auto block = shift(ray.current, l);
+			float t_exit = std::numeric_limits<float>::infinity();
+			uint a = 0;
+			for (uint i = 0; i < d; i++)
+			{
+				if (direction[i] == 0)
+					continue;
+				float boundary = direction[i] > 0 ? (block[i] + 1) << l : block[i] << l;
+				float t_i = (boundary - origin[i]) / direction[i];
+				if (t_i < t_exit)
+				{
+					t_exit = t_i;
+					a = i;
+				}
+			}
+			if (t_exit == std::numeric_limits<float>::infinity())
+				return false;
+
+			// the ray crosses into the next block along a, and along the other axes it's
+			// still in this block, and it never moves against its direction
+			for (uint i = 0; i < d; i++)
+			{
+				if (i == a || direction[i] == 0)
+					continue;
+				float first = block[i] << l;
+				float last = std::min((block[i] + 1) << l, IndexInt(u_bar[i])) - 1;
+				auto x = IndexInt(std::min(std::max(std::floor(origin[i] + direction[i] * t_exit),
+					first), last));
+				ray.current[i] = direction[i] > 0 ? std::max(ray.current[i], x) : std::min(ray.current[i], x);
+			}
+			if (direction[a] > 0)
+			{
+				ray.current[a] = (block[a] + 1) << l;
+				if (ray.current[a] >= u_bar[a])
+					return false;
+			}
+			else
+			{
+				if (block[a] == 0)
+					return false;
+				ray.current[a] = (block[a] << l) - 1;
+			}
+			ray.t = std::max(ray.t, t_exit);
+			crossings(origin, direction, ray);
+			return true;
+		}
+	};
+}
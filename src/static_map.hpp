@@ -0,0 +1,139 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include "psh.hpp"
+
+namespace psh
+{
+	// a read-only map whose tables are constant data, written out as C++ source by write_source
+	// a generated static_map is constexpr, so it's ready before the program starts:
+	// there's no construction and no memory allocation, the tables live in read-only memory
+	// to get the same tables on every run, build the map with a fixed seed and a serial workspace
+	// main.cpp has an example: write_static_map_example generates static_map_example.inl,
+	// which static_map_test compiles in and checks
+	template<uint d, class T, class PosInt, class HashInt, class Hash>
+	class static_map
+	{
+		using IndexInt = size_t;
+
+	public:
+		using hash_type = Hash;
+		using offset = point<d, PosInt>;
+		struct entry
+		{
+			T contents;
+			HashInt k;
+			HashInt hk;
+		};
+		using contents_writer = std::function<void(std::ostream&, const T&)>;
+
+	private:
+		Hash hash;
+		point<d, PosInt> m_bar;
+		IndexInt m;
+		PosInt r_bar;
+		IndexInt r;
+		IndexInt n;
+		const offset* phi;
+		const entry* H;
+
+	public:
+		// phi has r offsets and H has m entries, both as in the map they were taken from
+		constexpr static_map(const Hash& hash, const point<d, PosInt>& m_bar, IndexInt m,
+			PosInt r_bar, IndexInt r, IndexInt n, const offset* phi, const entry* H)
+			: hash(hash), m_bar(m_bar), m(m), r_bar(r_bar), r(r), n(n), phi(phi), H(H) { }
+
+		// the contents stored at p, or nullptr if p isn't in the map
+		// only hk is checked, like in packed_map: no other point of the domain the map was
+		// built for shares the hk of a slot, but a point outside that domain can match one
+		// and get the contents of an element that isn't its own
+		const T* find(const point<d, PosInt>& p) const
+		{
+			auto h0 = hash.h0(p);
+			auto h1 = hash.h1(p);
+			auto& e = H[point_to_index(h0 + point<d, IndexInt>(phi[point_to_index(h1, r_bar, r)]),
+				m_bar, m)];
+			if (e.hk != hash.hk(p, e.k))
+				return nullptr;
+			return &e.contents;
+		}
+
+		const T& get(const point<d, PosInt>& p) const
+		{
+			auto output = find(p);
+			if (output == nullptr)
+				throw std::out_of_range("Element not found in map");
+			return *output;
+		}
+
+		bool contains(const point<d, PosInt>& p) const
+		{
+			return find(p) != nullptr;
+		}
+
+		IndexInt size() const
+		{
+			return n;
+		}
+
+		// writes the tables of s as C++ source that defines a constexpr static_map called name,
+		// along with name_phi and name_H for its tables and name_type for its type
+		// type is the C++ name of this static_map type, e.g. "psh::static_map<2, int, ...>"
+		// write_contents writes a T as an initializer, by default it's written as a number
+		template<class Allocator>
+		static void write_source(std::ostream& stream, const map<d, T, PosInt, HashInt, Allocator, Hash>& s,
+			const std::string& name, const std::string& type,
+			const contents_writer& write_contents = write_number)
+		{
+			if (!s.positional_hashes)
+				throw std::invalid_argument("The map was built without positional hashes");
+			stream << "// generated by psh::static_map::write_source" << std::endl;
+			stream << "using " << name << "_type = " << type << ";" << std::endl;
+
+			stream << "const " << name << "_type::offset " << name << "_phi[] = {";
+			for (IndexInt i = 0; i < s.r; i++)
+			{
+				stream << (i % 8 == 0 ? "\n\t" : " ");
+				write_point(stream, s.phi[i]);
+				stream << ",";
+			}
+			stream << std::endl << "};" << std::endl;
+
+			stream << "const " << name << "_type::entry " << name << "_H[] = {";
+			for (IndexInt i = 0; i < s.m; i++)
+			{
+				auto& e = s.H[i];
+				stream << (i % 4 == 0 ? "\n\t" : " ") << "{";
+				write_contents(stream, e.contents);
+				stream << ", " << +e.k << ", " << +e.hk << "},";
+			}
+			stream << std::endl << "};" << std::endl;
+
+			stream << "constexpr " << name << "_type " << name << "(" << name << "_type::hash_type(";
+			s.hash.write_source(stream);
+			stream << "), ";
+			write_point(stream, s.m_bar);
+			stream << ", " << s.m << "u, " << +s.r_bar << ", " << s.r << "u, " << s.n << "u, "
+				<< name << "_phi, " << name << "_H);" << std::endl;
+		}
+
+	private:
+		static void write_number(std::ostream& stream, const T& contents)
+		{
+			stream << +contents;
+		}
+
+		static void write_point(std::ostream& stream, const point<d, PosInt>& p)
+		{
+			stream << "{{";
+			for (uint i = 0; i < d; i++)
+			{
+				stream << (i == 0 ? "" : ", ") << +p[i];
+			}
+			stream << "}}";
+		}
+	};
+}
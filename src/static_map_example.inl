@@ -0,0 +1,82 @@
+// generated by psh::static_map::write_source
+using static_map_example_type = psh::static_map<2, uint16_t, uint8_t, uint8_t>;
+const static_map_example_type::offset static_map_example_phi[] = {
+	{{5, 11}}, {{1, 7}}, {{0, 2}}, {{1, 6}}, {{4, 6}}, {{7, 6}}, {{0, 0}}, {{9, 2}},
+	{{3, 8}}, {{13, 4}}, {{0, 0}}, {{4, 9}}, {{10, 13}}, {{11, 11}}, {{14, 11}}, {{4, 11}},
+	{{7, 0}}, {{8, 12}}, {{1, 6}}, {{7, 13}}, {{14, 1}}, {{4, 1}}, {{0, 0}}, {{13, 4}},
+	{{1, 8}}, {{6, 13}}, {{13, 7}}, {{1, 0}}, {{0, 0}}, {{7, 8}}, {{2, 8}}, {{5, 5}},
+	{{11, 2}}, {{3, 3}}, {{0, 0}}, {{4, 3}}, {{4, 4}}, {{7, 2}}, {{11, 12}}, {{6, 9}},
+	{{0, 0}}, {{5, 12}}, {{2, 12}}, {{4, 9}}, {{6, 11}}, {{5, 14}}, {{13, 1}}, {{6, 4}},
+	{{6, 4}}, {{8, 13}}, {{7, 7}}, {{14, 2}}, {{0, 1}}, {{7, 13}}, {{12, 11}}, {{13, 14}},
+	{{12, 11}}, {{8, 13}}, {{14, 14}}, {{14, 0}}, {{10, 4}}, {{3, 4}}, {{10, 1}}, {{14, 7}},
+	{{11, 3}}, {{6, 3}}, {{1, 0}}, {{1, 14}}, {{3, 5}}, {{0, 7}}, {{12, 9}}, {{8, 9}},
+	{{1, 7}}, {{0, 10}}, {{10, 1}}, {{7, 14}}, {{0, 12}}, {{8, 3}}, {{7, 7}}, {{14, 9}},
+	{{11, 6}}, {{9, 3}}, {{13, 5}}, {{0, 0}}, {{10, 2}}, {{13, 0}}, {{0, 7}}, {{12, 6}},
+	{{7, 11}}, {{0, 0}}, {{5, 13}}, {{14, 0}}, {{10, 2}}, {{0, 0}}, {{7, 1}}, {{0, 0}},
+	{{10, 2}}, {{14, 13}}, {{13, 4}}, {{3, 13}}, {{2, 11}}, {{4, 13}}, {{9, 10}}, {{1, 7}},
+	{{3, 12}}, {{0, 0}}, {{12, 3}}, {{10, 0}}, {{11, 5}}, {{10, 12}}, {{0, 0}}, {{8, 3}},
+	{{3, 10}}, {{5, 8}}, {{1, 8}}, {{11, 14}}, {{11, 8}}, {{0, 0}}, {{12, 6}}, {{1, 14}},
+	{{0, 3}}, {{10, 4}}, {{9, 14}}, {{9, 9}}, {{11, 5}}, {{9, 7}}, {{4, 13}}, {{11, 4}},
+	{{0, 10}}, {{5, 8}}, {{5, 6}}, {{7, 13}}, {{3, 14}}, {{7, 14}}, {{11, 6}}, {{12, 9}},
+	{{4, 0}}, {{13, 13}}, {{8, 1}}, {{10, 7}}, {{4, 5}}, {{3, 8}}, {{0, 1}}, {{6, 4}},
+};
+const static_map_example_type::entry static_map_example_H[] = {
+	{641, 1, 13}, {0, 1, 1}, {889, 1, 20}, {665, 1, 101},
+	{626, 1, 157}, {155, 1, 7}, {0, 2, 0}, {0, 1, 1},
+	{798, 1, 70}, {38, 1, 175}, {444, 1, 1}, {366, 1, 113},
+	{811, 2, 46}, {325, 1, 119}, {718, 1, 132}, {575, 1, 176},
+	{326, 1, 144}, {364, 1, 63}, {37, 1, 150}, {247, 2, 90},
+	{220, 1, 82}, {234, 1, 169}, {757, 1, 76}, {588, 1, 238},
+	{719, 1, 157}, {338, 1, 188}, {339, 1, 213}, {470, 1, 132},
+	{78, 1, 144}, {352, 1, 19}, {510, 1, 101}, {117, 1, 88},
+	{248, 1, 7}, {483, 1, 194}, {928, 1, 213}, {770, 1, 138},
+	{980, 1, 226}, {313, 1, 82}, {64, 1, 50}, {785, 1, 1},
+	{76, 1, 94}, {103, 1, 250}, {731, 1, 201}, {589, 2, 152},
+	{902, 1, 82}, {90, 2, 140}, {915, 2, 228}, {182, 2, 146},
+	{941, 2, 190}, {627, 1, 182}, {602, 1, 76}, {181, 3, 236},
+	{482, 1, 169}, {208, 2, 108}, {914, 1, 126}, {521, 1, 113},
+	{652, 1, 32}, {548, 1, 13}, {11, 1, 19}, {797, 1, 45},
+	{863, 2, 48}, {824, 1, 201}, {823, 1, 176}, {13, 1, 69},
+	{536, 1, 232}, {52, 1, 13}, {850, 1, 76}, {993, 1, 32},
+	{471, 1, 157}, {680, 2, 58}, {39, 1, 200}, {784, 1, 232},
+	{301, 1, 38}, {1007, 1, 126}, {1006, 1, 101}, {732, 1, 226},
+	{327, 1, 169}, {640, 1, 244}, {65, 1, 75}, {759, 1, 126},
+	{0, 1, 1}, {129, 1, 125}, {183, 1, 188}, {91, 1, 213},
+	{679, 1, 188}, {954, 1, 95}, {0, 1, 0}, {417, 1, 94},
+	{940, 1, 1}, {456, 1, 38}, {967, 1, 157}, {418, 1, 119},
+	{875, 1, 182}, {142, 3, 122}, {509, 1, 76}, {929, 1, 238},
+	{705, 1, 63}, {523, 1, 163}, {195, 1, 225}, {1019, 1, 170},
+	{758, 1, 101}, {796, 1, 20}, {877, 1, 232}, {484, 1, 219},
+	{666, 1, 126}, {157, 2, 28}, {587, 1, 213}, {495, 1, 238},
+	{615, 1, 138}, {156, 1, 32}, {168, 1, 69}, {746, 1, 57},
+	{497, 1, 32}, {260, 1, 44}, {890, 2, 110}, {653, 1, 57},
+	{693, 1, 26}, {365, 1, 88}, {574, 1, 151}, {810, 1, 107},
+	{431, 1, 188}, {392, 1, 244}, {379, 2, 178}, {116, 2, 102},
+	{12, 1, 44}, {221, 1, 107}, {207, 1, 13}, {351, 1, 1},
+	{194, 1, 200}, {561, 2, 246}, {353, 1, 44}, {916, 1, 176},
+	{601, 1, 51}, {209, 1, 63}, {1020, 1, 195}, {771, 1, 163},
+	{901, 1, 57}, {274, 1, 138}, {130, 1, 150}, {405, 1, 57},
+	{745, 1, 32}, {968, 2, 252}, {143, 1, 219}, {654, 2, 96},
+	{300, 1, 13}, {876, 1, 207}, {783, 2, 140}, {955, 1, 120},
+	{286, 1, 182}, {942, 1, 51}, {667, 1, 151}, {692, 1, 1},
+	{837, 1, 7}, {903, 2, 52}, {273, 1, 113}, {445, 1, 26},
+	{628, 1, 207}, {613, 1, 88}, {522, 1, 138}, {0, 2, 0},
+	{458, 1, 88}, {312, 1, 57}, {340, 1, 238}, {809, 1, 82},
+	{0, 1, 1}, {443, 1, 232}, {888, 1, 251}, {235, 1, 194},
+	{772, 1, 188}, {0, 1, 1}, {24, 1, 88}, {0, 1, 1},
+	{0, 1, 1}, {63, 1, 32}, {104, 1, 19}, {1021, 1, 220},
+	{862, 1, 120}, {26, 2, 40}, {994, 1, 57}, {849, 1, 51},
+	{457, 1, 63}, {562, 2, 90}, {469, 1, 107}, {0, 1, 1},
+	{169, 1, 94}, {0, 1, 1}, {744, 1, 7}, {549, 1, 38},
+	{535, 1, 207}, {508, 1, 51}, {0, 1, 1}, {170, 2, 226},
+	{0, 1, 1}, {0, 1, 1}, {836, 1, 238}, {0, 1, 1},
+	{0, 2, 0}, {706, 1, 88}, {404, 1, 32}, {953, 2, 110},
+	{733, 1, 251}, {430, 1, 163}, {196, 1, 250}, {0, 1, 1},
+	{0, 1, 1}, {222, 2, 228}, {0, 1, 1}, {0, 1, 1},
+	{287, 1, 207}, {600, 1, 26}, {25, 1, 113}, {614, 1, 113},
+	{50, 1, 219}, {981, 1, 251}, {496, 1, 7}, {314, 1, 107},
+	{639, 1, 226}, {299, 1, 244}, {261, 1, 69}, {377, 1, 132},
+	{391, 1, 219}, {51, 1, 244}, {927, 1, 195}, {378, 1, 157},
+	{77, 1, 119},
+};
+constexpr static_map_example_type static_map_example(static_map_example_type::hash_type(53u, 193u, 393241u), {{15, 15}}, 225u, 12, 144u, 205u, static_map_example_phi, static_map_example_H);
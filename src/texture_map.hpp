@@ -0,0 +1,207 @@
+#pragma once
+
+#include <array>
+#include <stdexcept>
+#include <vector>
+#include "psh.hpp"
+
+namespace psh
+{
+	// how the texels of a texture_image are ordered in memory
+	enum class texture_layout
+	{
+		// row-major, the first dimension is the most significant, like point_to_index
+		linear,
+		// tiles of about 64 texels stored one after the other, row-major, with the texels
+		// inside a tile in Morton order, like the swizzled layouts GPUs use for textures
+		tiled
+	};
+
+	// a d-dimensional image, stored in either texture_layout
+	// the texels can be uploaded as they are, the size is padded to whole tiles
+	template<uint d, class Texel>
+	class texture_image
+	{
+		using IndexInt = size_t;
+		// tiles have an edge of 2^tile_bits texels, 64 texels in 2D and 3D
+		static constexpr uint tile_bits = d >= 6 ? 1 : 6 / d;
+		static constexpr IndexInt tile_width = IndexInt(1) << tile_bits;
+
+		point<d, IndexInt> width;
+		point<d, IndexInt> tiles;
+		texture_layout layout;
+		// the bits of a coordinate inside a tile, spread out to their place in the Morton order
+		std::array<IndexInt, d * tile_width> spread;
+		std::vector<Texel> texels;
+
+	public:
+		texture_image() : layout(texture_layout::linear), spread() { }
+		texture_image(const point<d, IndexInt>& width, texture_layout layout)
+			: width(width), layout(layout)
+		{
+			IndexInt size = 1;
+			for (uint i = 0; i < d; i++)
+			{
+				tiles[i] = (width[i] + tile_width - 1) / tile_width;
+				size *= layout == texture_layout::tiled ? tiles[i] * tile_width : width[i];
+				for (IndexInt c = 0; c < tile_width; c++)
+				{
+					IndexInt bits = 0;
+					for (uint b = 0; b < tile_bits; b++)
+					{
+						bits |= ((c >> b) & 1) << (b * d + (d - 1 - i));
+					}
+					spread[i * tile_width + c] = bits;
+				}
+			}
+			texels.resize(size);
+		}
+
+		// where the texel at c is stored
+		IndexInt address(const point<d, IndexInt>& c) const
+		{
+			IndexInt output = 0;
+			if (layout == texture_layout::linear)
+			{
+				for (uint i = 0; i < d; i++)
+				{
+					output = output * width[i] + c[i];
+				}
+				return output;
+			}
+
+			IndexInt tile = 0;
+			IndexInt inside = 0;
+			for (uint i = 0; i < d; i++)
+			{
+				tile = tile * tiles[i] + (c[i] >> tile_bits);
+				inside |= spread[i * tile_width + (c[i] & (tile_width - 1))];
+			}
+			return (tile << (tile_bits * d)) + inside;
+		}
+
+		const Texel& at(const point<d, IndexInt>& c) const
+		{
+			return texels[address(c)];
+		}
+		Texel& at(const point<d, IndexInt>& c)
+		{
+			return texels[address(c)];
+		}
+
+		const point<d, IndexInt>& size() const
+		{
+			return width;
+		}
+
+		// the texels in memory order, ready to be uploaded
+		const Texel* data() const
+		{
+			return texels.data();
+		}
+		IndexInt num_texels() const
+		{
+			return texels.size();
+		}
+
+		size_t memory_size() const
+		{
+			return sizeof(*this) + sizeof(Texel) * texels.capacity();
+		}
+	};
+
+	// a read-only copy of a finished map, with phi and H laid out as d-dimensional textures
+	// phi is an r_bar^d image of offsets and H is an m_bar image of (contents, k, hk) texels,
+	// with a table index i stored at the texel index_to_point(i), so the image dimensions
+	// are the ones the paper uses for its textures
+	// get is a CPU reference of the lookup a shader would do with these textures
+	template<uint d, class T, class PosInt, class HashInt, class Hash>
+	class texture_map
+	{
+		using IndexInt = size_t;
+
+	public:
+		struct texel
+		{
+			T contents;
+			HashInt k;
+			HashInt hk;
+		};
+
+	private:
+		Hash hash;
+		point<d, PosInt> m_bar;
+		IndexInt m;
+		PosInt r_bar;
+		IndexInt r;
+		texture_image<d, point<d, PosInt>> phi;
+		texture_image<d, texel> H;
+
+	public:
+		template<class Allocator>
+		texture_map(const map<d, T, PosInt, HashInt, Allocator, Hash>& s,
+			texture_layout layout = texture_layout::tiled)
+			: hash(s.hash), m_bar(s.m_bar), m(s.m), r_bar(s.r_bar), r(s.r),
+			  phi(point<d, IndexInt>::repeating(r_bar), layout),
+			  H(point<d, IndexInt>(m_bar), layout)
+		{
+			if (!s.positional_hashes)
+				throw std::invalid_argument("The map was built without positional hashes");
+			for (IndexInt i = 0; i < r; i++)
+			{
+				phi.at(phi_texel(i)) = s.phi[i];
+			}
+			for (IndexInt i = 0; i < m; i++)
+			{
+				auto& e = s.H[i];
+				H.at(H_texel(i)) = texel{e.contents, e.k, e.hk};
+			}
+		}
+
+		// the contents stored at p, or nullptr if p isn't in the map
+		// only the hash check is done, like in packed_map, so a point that was never stored
+		// can be found if it hashes to the same slot and hk as a stored one
+		const T* find(const point<d, PosInt>& p) const
+		{
+			auto h0 = hash.h0(p);
+			auto h1 = hash.h1(p);
+			auto& offset = phi.at(phi_texel(point_to_index(h1, r_bar, r)));
+			auto& e = H.at(H_texel(point_to_index(h0 + point<d, IndexInt>(offset), m_bar, m)));
+			if (e.hk != hash.hk(p, e.k))
+				return nullptr;
+			return &e.contents;
+		}
+
+		const T& get(const point<d, PosInt>& p) const
+		{
+			auto output = find(p);
+			if (output == nullptr)
+				throw std::out_of_range("Element not found in map");
+			return *output;
+		}
+
+		const texture_image<d, point<d, PosInt>>& offset_texture() const
+		{
+			return phi;
+		}
+		const texture_image<d, texel>& hash_texture() const
+		{
+			return H;
+		}
+
+		size_t memory_size() const
+		{
+			return sizeof(*this) - sizeof(phi) - sizeof(H) + phi.memory_size() + H.memory_size();
+		}
+
+	private:
+		point<d, IndexInt> phi_texel(IndexInt i) const
+		{
+			return point<d, IndexInt>(index_to_point<d>(i, r_bar, r));
+		}
+		point<d, IndexInt> H_texel(IndexInt i) const
+		{
+			return point<d, IndexInt>(index_to_point<d>(i, m_bar, m));
+		}
+	};
+}
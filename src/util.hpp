@@ -1,10 +1,65 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include "point.hpp"
 
+// hints the cpu to start loading the cache line at addr, without waiting for it
+#if defined(__GNUC__) || defined(__clang__)
+#define PSH_PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#include <xmmintrin.h>
+#define PSH_PREFETCH(addr) _mm_prefetch(reinterpret_cast<const char*>(addr), _MM_HINT_T0)
+#else
+#define PSH_PREFETCH(addr)
+#endif
+
 namespace psh
 {
+	// index of the lowest set bit, value must not be 0
+	inline uint count_trailing_zeros(uint64_t value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(value);
+#else
+		uint output = 0;
+		while ((value & 1) == 0)
+		{
+			value >>= 1;
+			output++;
+		}
+		return output;
+#endif
+	}
+
+	// number of set bits
+	inline uint count_bits(uint64_t value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_popcountll(value);
+#else
+		uint output = 0;
+		for (; value != 0; value &= value - 1)
+		{
+			output++;
+		}
+		return output;
+#endif
+	}
+
+	// sets bits in a word that other threads might be setting bits in at the same time
+	inline void atomic_or(uint64_t& word, uint64_t bits)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		__atomic_fetch_or(&word, bits, __ATOMIC_RELAXED);
+#elif defined(_MSC_VER)
+		_InterlockedOr64(reinterpret_cast<volatile long long*>(&word), (long long)(bits));
+#else
+		word |= bits;
+#endif
+	}
+
 	namespace
 	{
 		// these functions convert between multidimensional (points) and linear (index) coordinates
@@ -15,11 +70,11 @@ namespace psh
 		{
 			static constexpr Int point_to_index(const point<d, Int>& p, Int width, Int max)
 			{
+				// the first dimension is the most significant, like in index_to_point
 				Int index = p[0];
 				for (uint i = 1; i < d; i++)
 				{
-					index += width * p[i];
-					width *= width;
+					index = index * width + p[i];
 				}
 				return index % max;
 			}
@@ -94,4 +149,68 @@ namespace psh
 		static_assert(sizeof(IntS) <= sizeof(IntL), "IntS must be smaller or equal to IntL");
 		return point<d, IntS>(point_helpers<d, IntL>::index_to_point(index, IntL(width), max));
 	}
+
+	// same as above, but with a separate width in each dimension
+	// the first dimension is the most significant, just like the 2D and 3D versions
+	template<uint d, class IntS, class IntL>
+	constexpr IntL point_to_index(const point<d, IntL>& p, const point<d, IntS>& width, IntL max)
+	{
+		static_assert(sizeof(IntS) <= sizeof(IntL), "IntS must be smaller or equal to IntL");
+		IntL index = p[0];
+		for (uint i = 1; i < d; i++)
+		{
+			index = index * IntL(width[i]) + p[i];
+		}
+		return index % max;
+	}
+
+	template<uint d, class IntS, class IntL>
+	constexpr IntL point_to_index(const point<d, IntS>& p, const point<d, IntS>& width, IntL max)
+	{
+		static_assert(sizeof(IntS) <= sizeof(IntL), "IntS must be smaller or equal to IntL");
+		return point_to_index(point<d, IntL>(p), width, max);
+	}
+
+	template<uint d, class IntS, class IntL>
+	constexpr point<d, IntS> index_to_point(IntL index, const point<d, IntS>& width, IntL max)
+	{
+		static_assert(sizeof(IntS) <= sizeof(IntL), "IntS must be smaller or equal to IntL");
+		point<d, IntS> output;
+		index %= max;
+		for (uint i = d; i-- > 0;)
+		{
+			output[i] = IntS(index % IntL(width[i]));
+			index /= IntL(width[i]);
+		}
+		return output;
+	}
+
+	// interleaves the bits of all coordinates, so that sorting by the code
+	// visits the points in Morton (Z-curve) order
+	template<uint d, class Int>
+	constexpr uint64_t morton_code(const point<d, Int>& p)
+	{
+		static_assert(d * sizeof(Int) * 8 <= 64, "Morton code must fit in 64 bits");
+		uint64_t output = 0;
+		for (uint b = 0; b < sizeof(Int) * 8; b++)
+		{
+			for (uint i = 0; i < d; i++)
+			{
+				output |= uint64_t((p[i] >> b) & 1) << (b * d + i);
+			}
+		}
+		return output;
+	}
+
+	// the number of points in a box with the given widths
+	template<uint d, class IntS, class IntL = size_t>
+	constexpr IntL volume(const point<d, IntS>& width)
+	{
+		IntL output = 1;
+		for (uint i = 0; i < d; i++)
+		{
+			output *= IntL(width[i]);
+		}
+		return output;
+	}
 }